@@ -0,0 +1,196 @@
+/*
+ * Host-wide admission for expensive crypt() calls, see admit.h.
+ * Semaphore 0 holds the free units, semaphore 1 the total, both are set
+ * by one semop of the creator; others wait until sem_otime shows that it
+ * happened. The semaphore gets owner and mode of the file.
+ * Anyone can stat the file and so find the key, so an existing set is
+ * only used if root, this user or the owner of the file created it, and
+ * file and semaphore must not be writable by others.
+ *
+ * This file may be distributed under the same terms as pam_pwdfile.c.
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ipc.h>
+#include <sys/sem.h>
+#include <sys/stat.h>
+
+#include "admit.h"
+
+#define ADMIT_PROJ	'a'
+/* how long to wait for another process to set up the semaphore */
+#define ADMIT_INIT_TRIES	100
+#define ADMIT_INIT_PAUSE	10	/* ms */
+
+union semun {
+	int val;
+	struct semid_ds *buf;
+	unsigned short *array;
+};
+
+struct admit {
+	struct admit *next;
+	char *path;
+	int id;
+	unsigned units;
+};
+
+static struct admit *admits;
+static pthread_mutex_t admits_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int create(key_t key, const struct stat *st, unsigned units) {
+	struct sembuf init[2] = { { 0, units, 0 }, { 1, units, 0 } };
+	union semun arg;
+	struct semid_ds ds;
+	int id;
+
+	if ((id = semget(key, 2, IPC_CREAT | IPC_EXCL | (st->st_mode & 0666))) == -1)
+		return -1;
+	arg.buf = &ds;
+	if (semctl(id, 0, IPC_STAT, arg) == -1)
+		goto failed;
+	ds.sem_perm.uid = st->st_uid;
+	ds.sem_perm.gid = st->st_gid;
+	/* so the users who may use the file may use the semaphore */
+	if (semctl(id, 0, IPC_SET, arg) == -1)
+		goto failed;
+	if (semop(id, init, 2) == -1)
+		goto failed;
+	return id;
+
+failed:
+	semctl(id, 0, IPC_RMID);
+	return -1;
+}
+
+static int attach(key_t key, const struct stat *st) {
+	struct timespec pause = { 0, ADMIT_INIT_PAUSE * 1000000L };
+	union semun arg;
+	struct semid_ds ds;
+	int id, i;
+
+	if ((id = semget(key, 2, 0)) == -1)
+		return -1;
+	arg.buf = &ds;
+	for (i = 0; i < ADMIT_INIT_TRIES; i++) {
+		if (semctl(id, 0, IPC_STAT, arg) == -1)
+			return -1;
+		/* another set with the same key, or one somebody else made first */
+		if (ds.sem_nsems != 2 || ds.sem_perm.mode & S_IWOTH
+		    || (ds.sem_perm.cuid != 0 && ds.sem_perm.cuid != geteuid() && ds.sem_perm.cuid != st->st_uid)) {
+			errno = EPERM;
+			return -1;
+		}
+		if (ds.sem_otime)
+			return id;
+		nanosleep(&pause, NULL);
+	}
+	errno = ETIMEDOUT;
+	return -1;
+}
+
+static int open_sem(const char *path, unsigned units, unsigned *total) {
+	struct stat st;
+	key_t key;
+	int fd, id, i;
+
+	if ((fd = open(path, O_RDONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644)) == -1)
+		return -1;
+	i = fstat(fd, &st);
+	close(fd);
+	if (i == -1)
+		return -1;
+	if (!S_ISREG(st.st_mode) || (st.st_uid != 0 && st.st_uid != geteuid()) || st.st_mode & S_IWOTH) {
+		errno = EPERM;
+		return -1;
+	}
+	if ((key = ftok(path, ADMIT_PROJ)) == -1)
+		return -1;
+	/* whoever loses the race to create it attaches */
+	for (i = 0; i < 2; i++) {
+		if ((id = create(key, &st, units)) != -1 || errno != EEXIST)
+			break;
+		if ((id = attach(key, &st)) != -1 || errno != ENOENT)
+			break;
+	}
+	if (id == -1 || (i = semctl(id, 1, GETVAL)) == -1)
+		return -1;
+	*total = i;
+	return id;
+}
+
+struct admit *admit_get(const char *path, unsigned units) {
+	struct admit *admit;
+
+	if (!units || units > ADMIT_UNITS_MAX) {
+		errno = EINVAL;
+		return NULL;
+	}
+	pthread_mutex_lock(&admits_lock);
+	for (admit = admits; admit; admit = admit->next)
+		if (!strcmp(admit->path, path))
+			goto out;
+	if (!(admit = calloc(1, sizeof(*admit))) || !(admit->path = strdup(path))) {
+		free(admit);
+		admit = NULL;
+		goto out;
+	}
+	if ((admit->id = open_sem(path, units, &admit->units)) == -1) {
+		free(admit->path);
+		free(admit);
+		admit = NULL;
+		goto out;
+	}
+	admit->next = admits;
+	admits = admit;
+out:
+	pthread_mutex_unlock(&admits_lock);
+	return admit;
+}
+
+unsigned admit_units(const struct admit *admit) {
+	return admit->units;
+}
+
+static uint64_t now_ms(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+int admit_enter(struct admit *admit, unsigned units, unsigned timeout_ms) {
+	struct sembuf op = { 0, -(short) units, SEM_UNDO };
+	uint64_t deadline = now_ms() + timeout_ms, now, left;
+	struct timespec timeout;
+
+	for (;;) {
+		now = now_ms();
+		left = now < deadline ? deadline - now : 0;
+		timeout.tv_sec = left / 1000;
+		timeout.tv_nsec = left % 1000 * 1000000L;
+		if (semtimedop(admit->id, &op, 1, &timeout) == 0)
+			return 0;
+		if (errno != EINTR)
+			return -1;
+		/* a signal, try again for the rest of the time */
+		if (!left) {
+			errno = EAGAIN;
+			return -1;
+		}
+	}
+}
+
+void admit_leave(struct admit *admit, unsigned units) {
+	struct sembuf op = { 0, units, SEM_UNDO };
+
+	semop(admit->id, &op, 1);
+}
@@ -0,0 +1,25 @@
+#ifndef ADMIT_H
+#define ADMIT_H
+
+/*
+ * A counting semaphore shared by all processes on the host that use the
+ * same crypt_limit= file, to bound the memory concurrent checks of
+ * scrypt and yescrypt hashes take. It is a System V semaphore keyed by
+ * the file, so the units a process holds are given back by the kernel
+ * when it dies. The first process creates it with its number of units;
+ * it keeps them until it is removed, e.g. with ipcrm or a reboot.
+ */
+
+/* at most what semop can add in one operation */
+#define ADMIT_UNITS_MAX	32767
+
+struct admit;
+
+struct admit *admit_get(const char *path, unsigned units);
+/* the units of the semaphore, which may differ from those asked for in admit_get */
+unsigned admit_units(const struct admit *admit);
+/* -1 with errno EAGAIN when timeout ran out */
+int admit_enter(struct admit *admit, unsigned units, unsigned timeout_ms);
+void admit_leave(struct admit *admit, unsigned units);
+
+#endif				/* ADMIT_H */
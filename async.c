@@ -0,0 +1,126 @@
+/*
+ * pwdfile_verify_async: a fixed pool of worker threads, one per CPU the
+ * process may run on, taking verifications from a FIFO queue.
+ * The pool is started on first use. Queued passwords are wiped once
+ * they have been checked.
+ *
+ * This file may be distributed under the same terms as pam_pwdfile.c.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "batch.h"
+#include "pwdfile.h"
+
+#define ASYNC_MAX_QUEUED	65536
+
+struct job {
+	struct job *next;
+	const struct pwdfile_options *opts;
+	pwdfile_done_fn *done;
+	void *arg;
+	size_t size;
+	char *password;
+	char user[];		/* followed by password */
+};
+
+static struct job *head, **tail = &head;
+static unsigned queued, nworkers;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+static void *worker(void *unused) {
+	struct job *job;
+	enum pwdfile_result result;
+
+	for (;;) {
+		pthread_mutex_lock(&lock);
+		while (!head)
+			pthread_cond_wait(&cond, &lock);
+		job = head;
+		if (!(head = job->next))
+			tail = &head;
+		--queued;
+		pthread_mutex_unlock(&lock);
+
+		result = pwdfile_verify(job->opts, job->user, job->password);
+		job->done(result, job->arg);
+		explicit_bzero(job, job->size);
+		free(job);
+	}
+	return NULL;
+}
+
+/* the workers are gone in a child, so is the queue they would have worked on */
+static void atfork_child(void) {
+	head = NULL;
+	tail = &head;
+	queued = nworkers = 0;
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&cond, NULL);
+}
+
+static void register_atfork(void) {
+	pthread_atfork(NULL, NULL, atfork_child);
+}
+
+/* called with lock held */
+static int start_workers(void) {
+	pthread_attr_t attr;
+	pthread_t thread;
+	unsigned i, n = batch_cpus();
+	int err = 0;
+
+	pthread_once(&atfork_once, register_atfork);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	for (i = 0; i < n; i++) {
+		if ((err = pthread_create(&thread, &attr, worker, NULL)))
+			break;
+		++nworkers;
+	}
+	pthread_attr_destroy(&attr);
+	if (!nworkers) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+int pwdfile_verify_async(const struct pwdfile_options *opts, const char *user, const char *password,
+			 pwdfile_done_fn *done, void *arg) {
+	size_t ulen = strlen(user) + 1, plen = strlen(password) + 1;
+	struct job *job;
+
+	if (!(job = malloc(sizeof(*job) + ulen + plen)))
+		return -1;
+	job->next = NULL;
+	job->opts = opts;
+	job->done = done;
+	job->arg = arg;
+	job->size = sizeof(*job) + ulen + plen;
+	memcpy(job->user, user, ulen);
+	job->password = job->user + ulen;
+	memcpy(job->password, password, plen);
+
+	pthread_mutex_lock(&lock);
+	if ((!nworkers && start_workers() == -1) || queued >= ASYNC_MAX_QUEUED) {
+		if (nworkers)
+			errno = EAGAIN;
+		pthread_mutex_unlock(&lock);
+		explicit_bzero(job, job->size);
+		free(job);
+		return -1;
+	}
+	*tail = job;
+	tail = &job->next;
+	++queued;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&lock);
+	return 0;
+}
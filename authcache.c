@@ -0,0 +1,158 @@
+/*
+ * Cache of recent verification results, so repeated logins with the same
+ * password don't have to run crypt() again.
+ *
+ * Nothing secret is stored in plain: an entry is identified by an HMAC
+ * of user and stored crypt string and holds an HMAC of the password.
+ * The HMAC key is random and never leaves the process.
+ * A changed crypt string in pwdfile gives a different identity, so its
+ * old entries can't match any more.
+ *
+ * This file may be distributed under the same terms as pam_pwdfile.c.
+ */
+
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/random.h>
+
+#include "sha256.h"
+#include "authcache.h"
+
+#define AUTHCACHE_SLOTS	1024	/* power of two */
+
+struct authcache_entry {
+	unsigned char id[32];	/* HMAC(user, stored crypt) */
+	unsigned char mac[32];	/* HMAC(user, stored crypt, password) */
+	time_t expires;
+	int good;
+};
+
+static struct authcache_entry entries[AUTHCACHE_SLOTS];
+static unsigned long hits, misses;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* hash contexts after absorbing key ^ ipad and key ^ opad */
+static struct SHA256Context inner, outer;
+static int have_key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+
+static void init_key(void) {
+	unsigned char key[64], pad[64];
+	int i, fd;
+
+	memset(key, 0, sizeof(key));
+	if (getrandom(key, 32, 0) != 32) {
+		if ((fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC)) == -1)
+			return;
+		i = read(fd, key, 32);
+		close(fd);
+		if (i != 32)
+			return;
+	}
+
+	for (i = 0; i < 64; i++)
+		pad[i] = key[i] ^ 0x36;
+	SHA256Init(&inner);
+	SHA256Update(&inner, pad, 64);
+	for (i = 0; i < 64; i++)
+		pad[i] = key[i] ^ 0x5c;
+	SHA256Init(&outer);
+	SHA256Update(&outer, pad, 64);
+	memset(key, 0, sizeof(key));
+	memset(pad, 0, sizeof(pad));
+	have_key = 1;
+}
+
+/* HMAC over the NUL-terminated strings, password may be NULL */
+static void hmac(unsigned char out[32], const char *user, const char *stored, const char *password) {
+	struct SHA256Context ctx = inner;
+	unsigned char digest[32];
+
+	SHA256Update(&ctx, user, strlen(user) + 1);
+	SHA256Update(&ctx, stored, strlen(stored) + 1);
+	if (password)
+		SHA256Update(&ctx, password, strlen(password) + 1);
+	SHA256Final(digest, &ctx);
+
+	ctx = outer;
+	SHA256Update(&ctx, digest, sizeof(digest));
+	SHA256Final(out, &ctx);
+	memset(digest, 0, sizeof(digest));
+}
+
+/* compare without leaking the position of the first difference */
+static int equal(const unsigned char *a, const unsigned char *b, size_t len) {
+	unsigned char diff = 0;
+
+	while (len--)
+		diff |= *a++ ^ *b++;
+	return !diff;
+}
+
+static time_t now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+enum authcache_result authcache_check(const char *user, const char *stored, const char *password) {
+	unsigned char id[32], mac[32];
+	struct authcache_entry *e;
+	enum authcache_result result = AUTHCACHE_MISS;
+
+	pthread_once(&key_once, init_key);
+	if (!have_key)
+		return AUTHCACHE_MISS;
+
+	hmac(id, user, stored, NULL);
+	hmac(mac, user, stored, password);
+	e = &entries[(id[0] | id[1] << 8) & (AUTHCACHE_SLOTS - 1)];
+
+	pthread_mutex_lock(&lock);
+	if (e->expires > now() && equal(e->id, id, sizeof(id)) && equal(e->mac, mac, sizeof(mac)))
+		result = e->good ? AUTHCACHE_GOOD : AUTHCACHE_BAD;
+	if (result == AUTHCACHE_MISS)
+		++misses;
+	else
+		++hits;
+	pthread_mutex_unlock(&lock);
+
+	memset(mac, 0, sizeof(mac));
+	return result;
+}
+
+void authcache_store(const char *user, const char *stored, const char *password, int good, unsigned ttl) {
+	unsigned char id[32], mac[32];
+	struct authcache_entry *e;
+
+	pthread_once(&key_once, init_key);
+	if (!have_key)
+		return;
+
+	hmac(id, user, stored, NULL);
+	hmac(mac, user, stored, password);
+	e = &entries[(id[0] | id[1] << 8) & (AUTHCACHE_SLOTS - 1)];
+
+	pthread_mutex_lock(&lock);
+	/* a wrong password must not evict the user's good entry */
+	if (good || !e->good || e->expires <= now() || !equal(e->id, id, sizeof(id))) {
+		memcpy(e->id, id, sizeof(id));
+		memcpy(e->mac, mac, sizeof(mac));
+		e->expires = now() + ttl;
+		e->good = good;
+	}
+	pthread_mutex_unlock(&lock);
+
+	memset(mac, 0, sizeof(mac));
+}
+
+void authcache_counters(unsigned long *h, unsigned long *m) {
+	pthread_mutex_lock(&lock);
+	*h = hits;
+	*m = misses;
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,14 @@
+#ifndef AUTHCACHE_H
+#define AUTHCACHE_H
+
+enum authcache_result {
+	AUTHCACHE_MISS,
+	AUTHCACHE_GOOD,		/* password verified recently */
+	AUTHCACHE_BAD,		/* same wrong password tried recently */
+};
+
+enum authcache_result authcache_check(const char *user, const char *stored, const char *password);
+void authcache_store(const char *user, const char *stored, const char *password, int good, unsigned ttl);
+void authcache_counters(unsigned long *hits, unsigned long *misses);
+
+#endif				/* AUTHCACHE_H */
@@ -0,0 +1,142 @@
+/*
+ * Work stealing over ranges of units, see batch.h.
+ * A thread takes units from the front of its range and a thief moves
+ * the back half of the victim's range into its own; both under the
+ * range's lock, which is cheap next to a unit of crypt() work. Thieves
+ * pick their victim without locks, so the bounds are stored atomically.
+ * Threads are started for each batch and exit with it.
+ *
+ * This file may be distributed under the same terms as pam_pwdfile.c.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "batch.h"
+
+struct range {
+	pthread_mutex_t lock;
+	size_t next, end;
+} __attribute__((aligned(64)));
+
+struct batch {
+	batch_fn *fn;
+	void *arg;
+	struct range *ranges;
+	unsigned nthreads;
+};
+
+struct worker {
+	struct batch *batch;
+	unsigned self;
+};
+
+unsigned batch_cpus(void) {
+	cpu_set_t set;
+	long n;
+
+	if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0)
+		return CPU_COUNT(&set);
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? n : 1;
+}
+
+static int take(struct range *range, size_t *unit) {
+	int found;
+
+	pthread_mutex_lock(&range->lock);
+	if ((found = range->next < range->end)) {
+		*unit = range->next;
+		__atomic_store_n(&range->next, *unit + 1, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&range->lock);
+	return found;
+}
+
+/* 0 once all ranges are empty, or being worked off by their thieves */
+static int steal(struct batch *batch, unsigned self) {
+	struct range *victim = NULL, *own = &batch->ranges[self];
+	size_t most = 0, left, next, end;
+	unsigned i;
+
+	for (i = 0; i < batch->nthreads; i++) {
+		struct range *range = &batch->ranges[i];
+
+		left = __atomic_load_n(&range->end, __ATOMIC_RELAXED) - __atomic_load_n(&range->next, __ATOMIC_RELAXED);
+		if (i != self && left > most && left <= (size_t) -1 / 2) {
+			most = left;
+			victim = range;
+		}
+	}
+	if (!victim)
+		return 0;
+
+	pthread_mutex_lock(&victim->lock);
+	end = victim->end;
+	next = victim->next < end ? end - (end - victim->next + 1) / 2 : end;
+	__atomic_store_n(&victim->end, next, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&victim->lock);
+
+	pthread_mutex_lock(&own->lock);
+	__atomic_store_n(&own->next, next, __ATOMIC_RELAXED);
+	__atomic_store_n(&own->end, end, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&own->lock);
+	/* the victim may have finished meanwhile, look again */
+	return 1;
+}
+
+static void *work(void *arg) {
+	struct worker *worker = arg;
+	struct batch *batch = worker->batch;
+	size_t unit;
+
+	do
+		while (take(&batch->ranges[worker->self], &unit))
+			batch->fn(batch->arg, unit);
+	while (steal(batch, worker->self));
+	return NULL;
+}
+
+void batch_run(size_t units, batch_fn *fn, void *arg) {
+	struct batch batch = { fn, arg, NULL, batch_cpus() };
+	struct worker *workers;
+	pthread_t *threads;
+	unsigned i, started;
+	size_t unit;
+
+	if (batch.nthreads > units)
+		batch.nthreads = units ? units : 1;
+	/* without memory, or with one thread, the caller does it all */
+	if (batch.nthreads == 1
+	    || !(batch.ranges = aligned_alloc(64, batch.nthreads * sizeof(*batch.ranges)))
+	    || !(workers = calloc(batch.nthreads, sizeof(*workers) + sizeof(*threads)))) {
+		free(batch.ranges);
+		for (unit = 0; unit < units; unit++)
+			fn(arg, unit);
+		return;
+	}
+	threads = (pthread_t *) (workers + batch.nthreads);
+
+	for (i = 0; i < batch.nthreads; i++) {
+		pthread_mutex_init(&batch.ranges[i].lock, NULL);
+		batch.ranges[i].next = units * i / batch.nthreads;
+		batch.ranges[i].end = units * (i + 1) / batch.nthreads;
+		workers[i].batch = &batch;
+		workers[i].self = i;
+	}
+	/* the ranges of threads that couldn't be started are stolen */
+	for (started = 1; started < batch.nthreads; started++)
+		if (pthread_create(&threads[started], NULL, work, &workers[started]))
+			break;
+	work(&workers[0]);
+	for (i = 1; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < batch.nthreads; i++)
+		pthread_mutex_destroy(&batch.ranges[i].lock);
+	free(workers);
+	free(batch.ranges);
+}
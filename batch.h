@@ -0,0 +1,18 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+
+/*
+ * Run fn for units 0 to units - 1 on one thread per available CPU, the
+ * calling one included, and return when all are done. Each thread
+ * starts with an equal share and steals half of the largest remaining
+ * share when it runs out, so units may take very different times.
+ */
+
+typedef void batch_fn(void *arg, size_t unit);
+
+unsigned batch_cpus(void);
+void batch_run(size_t units, batch_fn *fn, void *arg);
+
+#endif				/* BATCH_H */
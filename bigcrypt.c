@@ -15,17 +15,27 @@
  * libc crypt function. The result of the encryption for one block
  * provides the salt for the suceeding block.
  * 
- * Restrictions: The buffer used to hold the encrypted result is
- * statically allocated. (see MAX_PASS_LEN below).  This is necessary,
- * as the returned pointer points to "static data that are overwritten
- * by each call", (XPG3: XSI System Interface + Headers pg 109), and
- * this is a drop in replacement for crypt();
+ * Restrictions: The buffer used by bigcrypt() to hold the encrypted
+ * result is statically allocated. (see MAX_SEGMENTS below).  This is
+ * necessary, as the returned pointer points to "static data that are
+ * overwritten by each call", (XPG3: XSI System Interface + Headers pg
+ * 109), and this is a drop in replacement for crypt();
+ * bigcrypt_r() is the reentrant variant, like crypt_r() it takes the
+ * caller's struct crypt_data and writes to the caller's outbuf of
+ * BIGCRYPT_OUTPUT_SIZE bytes.
  *
  * Andy Phillips <atp@mssl.ucl.ac.uk>
  */
 
+#ifdef USE_CRYPT_R
+#define _GNU_SOURCE
+#include <crypt.h>
+#define CRYPT(key, salt, data)	crypt_r(key, salt, data)
+#else
 #define _XOPEN_SOURCE 700
 #include <unistd.h>
+#define CRYPT(key, salt, data)	crypt(key, salt)
+#endif
 #include <string.h>
 
 #include "bigcrypt.h"
@@ -41,14 +51,12 @@
 #define SALT_SIZE          2
 #define ESEGMENT_SIZE      11
 
-char *bigcrypt(char const * key, char const * salt) {
-	static char outbuf[MAX_SEGMENTS * ESEGMENT_SIZE + SALT_SIZE + 1];	/* static storage area */
-
+static char *do_bigcrypt(char const * key, char const * salt, char * outbuf, void * data) {
 	unsigned char n_seg, seg;
-	char * outptr;
+	char * outptr, * crypted;
 
 	/* ensure NUL-termination */
-	memset(outbuf, 0, sizeof(outbuf));
+	memset(outbuf, 0, BIGCRYPT_OUTPUT_SIZE);
 
 	if (strlen(salt) == (SALT_SIZE + ESEGMENT_SIZE)) /* conventional crypt */
 		n_seg = 1;
@@ -59,7 +67,9 @@ char *bigcrypt(char const * key, char const * salt) {
 
 	/* first block is special and just traditional crypt() */
 	outptr = outbuf;
-	strncpy(outptr, crypt(key, salt), SALT_SIZE + ESEGMENT_SIZE);
+	if (!(crypted = CRYPT(key, salt, data)))
+		return NULL;
+	strncpy(outptr, crypted, SALT_SIZE + ESEGMENT_SIZE);
 
 	for (seg = 1, outptr += SALT_SIZE; seg < n_seg; ++seg) {
 		/* subsequent blocks use the previous output block for salt input */
@@ -67,8 +77,26 @@ char *bigcrypt(char const * key, char const * salt) {
 		key += SEGMENT_SIZE;
 		outptr += ESEGMENT_SIZE;
 		/* and omit the salt on output */
-		strncpy(outptr, crypt(key, salt) + SALT_SIZE, ESEGMENT_SIZE);
+		if (!(crypted = CRYPT(key, salt, data)))
+			return NULL;
+		strncpy(outptr, crypted + SALT_SIZE, ESEGMENT_SIZE);
 	}
 
 	return outbuf;
 }
+
+#ifdef USE_CRYPT_R
+char *bigcrypt_r(char const * key, char const * salt, char * outbuf, struct crypt_data * data) {
+	return do_bigcrypt(key, salt, outbuf, data);
+}
+#endif
+
+char *bigcrypt(char const * key, char const * salt) {
+	static char outbuf[BIGCRYPT_OUTPUT_SIZE];	/* static storage area */
+#ifdef USE_CRYPT_R
+	static struct crypt_data data;
+	return do_bigcrypt(key, salt, outbuf, &data);
+#else
+	return do_bigcrypt(key, salt, outbuf, NULL);
+#endif
+}
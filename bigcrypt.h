@@ -1 +1,7 @@
+#define BIGCRYPT_OUTPUT_SIZE (16 * 11 + 2 + 1)
+
 extern char *bigcrypt(const char *key, const char *salt);
+#ifdef USE_CRYPT_R
+struct crypt_data;
+extern char *bigcrypt_r(const char *key, const char *salt, char *outbuf, struct crypt_data *data);
+#endif
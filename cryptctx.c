@@ -0,0 +1,145 @@
+/*
+ * Per-thread crypt() state, see cryptctx.h.
+ *
+ * This file may be distributed under the same terms as pam_pwdfile.c.
+ */
+
+#ifdef USE_CRYPT_R
+#define _GNU_SOURCE
+#include <crypt.h>
+#else
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+#include <unistd.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "bigcrypt.h"
+#include "sha_crypt.h"
+#include "cryptctx.h"
+
+#ifdef CRYPT_OUTPUT_SIZE
+#define CRYPTCTX_OUTPUT_SIZE	CRYPT_OUTPUT_SIZE
+#else
+#define CRYPTCTX_OUTPUT_SIZE	384
+#endif
+
+struct cryptctx {
+#ifdef USE_CRYPT_R
+	struct crypt_data data;
+#endif
+	/* at least SHA_CRYPT_OUTPUT_SIZE, which is less than either */
+	char output[CRYPTCTX_OUTPUT_SIZE > BIGCRYPT_OUTPUT_SIZE ? CRYPTCTX_OUTPUT_SIZE : BIGCRYPT_OUTPUT_SIZE];
+};
+
+static pthread_key_t key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static int have_key;
+#ifndef USE_CRYPT_R
+static pthread_mutex_t crypt_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void destroy(void *ctx) {
+	explicit_bzero(ctx, sizeof(struct cryptctx));
+	free(ctx);
+}
+
+static void make_key(void) {
+	have_key = !pthread_key_create(&key, destroy);
+}
+
+struct cryptctx *cryptctx_get(void) {
+	struct cryptctx *ctx;
+
+	pthread_once(&key_once, make_key);
+	if (!have_key)
+		return NULL;
+	if ((ctx = pthread_getspecific(key)))
+		return ctx;
+	/* zeroed, so crypt_data.initialized is 0 */
+	if (!(ctx = calloc(1, sizeof(*ctx))))
+		return NULL;
+	if (pthread_setspecific(key, ctx)) {
+		free(ctx);
+		return NULL;
+	}
+	return ctx;
+}
+
+const char *cryptctx_crypt(struct cryptctx *ctx, const char *key, const char *salt) {
+#ifdef USE_CRYPT_R
+	return crypt_r(key, salt, &ctx->data);
+#else
+	const char *crypted;
+
+	pthread_mutex_lock(&crypt_lock);
+	if ((crypted = crypt(key, salt)) && strlen(crypted) < sizeof(ctx->output))
+		crypted = strcpy(ctx->output, crypted);
+	else
+		crypted = NULL;
+	pthread_mutex_unlock(&crypt_lock);
+	return crypted;
+#endif
+}
+
+const char *cryptctx_sha_crypt(struct cryptctx *ctx, const char *key, const char *salt) {
+	const char *crypted;
+
+	if ((crypted = sha_crypt_r(key, salt, ctx->output)))
+		return crypted;
+	return cryptctx_crypt(ctx, key, salt);
+}
+
+const char *cryptctx_bigcrypt(struct cryptctx *ctx, const char *key, const char *salt) {
+#ifdef USE_CRYPT_R
+	return bigcrypt_r(key, salt, ctx->output, &ctx->data);
+#else
+	const char *crypted;
+
+	/* bigcrypt uses crypt() and a static buffer of its own */
+	pthread_mutex_lock(&crypt_lock);
+	if ((crypted = bigcrypt(key, salt)))
+		crypted = strcpy(ctx->output, crypted);
+	pthread_mutex_unlock(&crypt_lock);
+	return crypted;
+#endif
+}
+
+const char *cryptctx_hash(struct cryptctx *ctx, const char *key, const char *prefix, unsigned long cost) {
+#ifdef CRYPT_GENSALT_IMPLEMENTS_AUTO_ENTROPY
+	char setting[CRYPT_GENSALT_OUTPUT_SIZE];
+	const char *crypted;
+
+	/* no random bytes given: libxcrypt gets them from the kernel */
+	if (!crypt_gensalt_rn(prefix, cost, NULL, 0, setting, sizeof(setting)))
+		return NULL;
+	/* libxcrypt fails with a string starting with '*' instead of NULL */
+	if ((crypted = cryptctx_crypt(ctx, key, setting)) && *crypted == '*') {
+		errno = EINVAL;
+		return NULL;
+	}
+	return crypted;
+#else
+	errno = ENOSYS;
+	return NULL;
+#endif
+}
+
+/*
+ * Remove what is derived from the password, keep what only depends on
+ * the salt or is precomputed. libxcrypt clears its scratch space itself.
+ */
+void cryptctx_wipe(struct cryptctx *ctx) {
+	explicit_bzero(ctx->output, sizeof(ctx->output));
+#if defined(USE_CRYPT_R) && defined(CRYPT_OUTPUT_SIZE)
+	explicit_bzero(ctx->data.output, sizeof(ctx->data.output));
+#elif defined(USE_CRYPT_R) && defined(__GLIBC__)
+	explicit_bzero(ctx->data.keysched, sizeof(ctx->data.keysched));
+	explicit_bzero(ctx->data.crypt_3_buf, sizeof(ctx->data.crypt_3_buf));
+#elif defined(USE_CRYPT_R)
+	explicit_bzero(&ctx->data, sizeof(ctx->data));
+#endif
+}
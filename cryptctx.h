@@ -0,0 +1,24 @@
+#ifndef CRYPTCTX_H
+#define CRYPTCTX_H
+
+/*
+ * Per-thread state for crypt(), allocated on first use and reused:
+ * with USE_CRYPT_R a struct crypt_data, too big for small thread
+ * stacks and expensive to initialize for every traditional DES hash.
+ * Without it, calls of crypt() are serialized and the result is copied
+ * to the thread's buffer. Results stay valid until the next call in
+ * the same thread or cryptctx_wipe.
+ */
+
+struct cryptctx;
+
+struct cryptctx *cryptctx_get(void);
+const char *cryptctx_crypt(struct cryptctx *ctx, const char *key, const char *salt);
+/* $5$ and $6$ by sha_crypt.c where it can, anything else by cryptctx_crypt */
+const char *cryptctx_sha_crypt(struct cryptctx *ctx, const char *key, const char *salt);
+const char *cryptctx_bigcrypt(struct cryptctx *ctx, const char *key, const char *salt);
+/* a new hash of key with a random salt, ENOSYS without crypt_gensalt */
+const char *cryptctx_hash(struct cryptctx *ctx, const char *key, const char *prefix, unsigned long cost);
+void cryptctx_wipe(struct cryptctx *ctx);
+
+#endif				/* CRYPTCTX_H */
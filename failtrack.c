@@ -0,0 +1,128 @@
+/*
+ * Shared failure counters, see failtrack.h.
+ * A slot is one 64 bit word updated with compare and swap, so that
+ * processes never wait for each other and a crashed one can't leave a
+ * lock behind. Keys are 64 bit hashes: the low bits choose the bucket,
+ * the high bits are the tag stored in the slot. Two keys with the same
+ * bucket and tag share a count, rarely enough not to matter.
+ *
+ * This file may be distributed under the same terms as pam_pwdfile.c.
+ */
+
+#include <stddef.h>
+#include <time.h>
+
+#include "failtrack.h"
+
+#define TAG_BITS	20
+#define COUNT_BITS	12
+#define COUNT_MAX	((1U << COUNT_BITS) - 1)
+#define BUCKETS		(FAILTRACK_SLOTS / FAILTRACK_WAYS)
+
+_Static_assert(offsetof(struct failtrack, slots) % 64 == 0, "buckets not cache aligned");
+
+#define SLOT(tag, count, time) \
+	((uint64_t) (tag) << (COUNT_BITS + 32) | (uint64_t) (count) << 32 | (time))
+#define SLOT_TAG(slot)		((uint32_t) ((slot) >> (COUNT_BITS + 32)))
+#define SLOT_COUNT(slot)	((uint32_t) ((slot) >> 32) & COUNT_MAX)
+#define SLOT_TIME(slot)		((uint32_t) (slot))
+
+/* never 0, so that an empty slot matches no key */
+static uint32_t tag(uint64_t key) {
+	uint32_t t = key >> (64 - TAG_BITS);
+
+	return t ? t : 1;
+}
+
+static uint64_t *bucket(const struct failtrack *ft, uint64_t key) {
+	return (uint64_t *) &ft->slots[(key % BUCKETS) * FAILTRACK_WAYS];
+}
+
+static uint32_t now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+/* halved for every window since the last failure */
+static uint32_t decayed(uint64_t slot, uint32_t t, unsigned window) {
+	uint32_t windows = (t - SLOT_TIME(slot)) / (window ? window : 1);
+
+	return windows >= COUNT_BITS ? 0 : SLOT_COUNT(slot) >> windows;
+}
+
+struct failtrack *failtrack_get(const char *path) {
+	return shm_get(path, sizeof(struct failtrack), FAILTRACK_MAGIC, FAILTRACK_VERSION);
+}
+
+/* FNV-1a 64 of kind and name, users and hosts with the same name differ */
+uint64_t failtrack_key(enum failtrack_kind kind, const char *name) {
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	h = (h ^ kind) * 0x100000001b3ULL;
+	h = (h ^ ':') * 0x100000001b3ULL;
+	for (; *name; name++)
+		h = (h ^ (unsigned char) *name) * 0x100000001b3ULL;
+	/* spread the low bits up for the tag */
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h;
+}
+
+unsigned failtrack_count(const struct failtrack *ft, uint64_t key, unsigned window) {
+	uint64_t *b = bucket(ft, key), slot;
+	uint32_t t = tag(key), n = now();
+	int i;
+
+	for (i = 0; i < FAILTRACK_WAYS; i++) {
+		slot = __atomic_load_n(&b[i], __ATOMIC_RELAXED);
+		if (SLOT_TAG(slot) == t)
+			return decayed(slot, n, window);
+	}
+	return 0;
+}
+
+void failtrack_fail(struct failtrack *ft, uint64_t key, unsigned window) {
+	uint64_t *b = bucket(ft, key), slot, *victim;
+	uint32_t t = tag(key), n = now(), count, fewest;
+	int i;
+
+	for (;;) {
+		victim = NULL;
+		fewest = COUNT_MAX + 1;
+		for (i = 0; i < FAILTRACK_WAYS; i++) {
+			slot = __atomic_load_n(&b[i], __ATOMIC_RELAXED);
+			if (SLOT_TAG(slot) == t) {
+				victim = &b[i];
+				break;
+			}
+			if ((count = SLOT_TAG(slot) ? decayed(slot, n, window) : 0) < fewest) {
+				fewest = count;
+				victim = &b[i];
+			}
+		}
+		slot = __atomic_load_n(victim, __ATOMIC_RELAXED);
+		count = SLOT_TAG(slot) == t ? decayed(slot, n, window) : 0;
+		if (count < COUNT_MAX)
+			count++;
+		if (__atomic_compare_exchange_n(victim, &slot, SLOT(t, count, n), 0,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			return;
+	}
+}
+
+void failtrack_clear(struct failtrack *ft, uint64_t key) {
+	uint64_t *b = bucket(ft, key), slot;
+	uint32_t t = tag(key);
+	int i;
+
+	for (i = 0; i < FAILTRACK_WAYS; i++) {
+		slot = __atomic_load_n(&b[i], __ATOMIC_RELAXED);
+		if (SLOT_TAG(slot) == t) {
+			__atomic_compare_exchange_n(&b[i], &slot, 0, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+			return;
+		}
+	}
+}
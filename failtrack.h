@@ -0,0 +1,41 @@
+#ifndef FAILTRACK_H
+#define FAILTRACK_H
+
+#include <stdint.h>
+
+#include "shm.h"
+
+/*
+ * Recent authentication failures shared by all processes using the same
+ * failtrack= file, on a tmpfs like /run, so that a brute force attempt is
+ * refused before it costs a crypt(). Failures are counted per key, a
+ * user name or a remote host, and the count halves with every window
+ * that passes without a new one.
+ * The table has a fixed number of slots; when a bucket is full the key
+ * with the fewest recent failures is forgotten.
+ */
+
+#define FAILTRACK_MAGIC		0x70776466U	/* "pwdf" */
+#define FAILTRACK_VERSION	1
+#define FAILTRACK_SLOTS		65536
+#define FAILTRACK_WAYS		8	/* slots per bucket, one cache line */
+
+struct failtrack {
+	struct shm_header header;
+	uint32_t pad[14];
+	/* tag:20 count:12 seconds:32 */
+	uint64_t slots[FAILTRACK_SLOTS] __attribute__((aligned(64)));
+};
+
+enum failtrack_kind {
+	FAILTRACK_USER = 'u',
+	FAILTRACK_HOST = 'h',
+};
+
+struct failtrack *failtrack_get(const char *path);
+uint64_t failtrack_key(enum failtrack_kind kind, const char *name);
+unsigned failtrack_count(const struct failtrack *ft, uint64_t key, unsigned window);
+void failtrack_fail(struct failtrack *ft, uint64_t key, unsigned window);
+void failtrack_clear(struct failtrack *ft, uint64_t key);
+
+#endif				/* FAILTRACK_H */
@@ -0,0 +1,69 @@
+/*
+ * Grace periods, see grace.h.
+ *
+ * Readers count themselves in one of two counters, selected by the low
+ * bit of phase. grace_wait flips the phase and waits for the counter
+ * that was in use to drain, twice, so readers that picked a counter
+ * just before a flip are waited for as well. New readers never block
+ * a writer for long, as they count into the other counter.
+ * The counters are striped over cache lines to keep threads from
+ * bouncing one line between CPUs.
+ *
+ * This file may be distributed under the same terms as pam_pwdfile.c.
+ */
+
+#include <time.h>
+#include <pthread.h>
+
+#include "grace.h"
+
+#define GRACE_STRIPES	16	/* power of two */
+
+static struct {
+	unsigned long count[2];
+} __attribute__((aligned(64))) readers[GRACE_STRIPES];
+
+static unsigned phase;
+static unsigned next_stripe;
+static __thread unsigned stripe = -1U;
+static pthread_mutex_t wait_lock = PTHREAD_MUTEX_INITIALIZER;
+
+unsigned grace_enter(void) {
+	unsigned idx;
+
+	if (stripe == -1U)
+		stripe = __atomic_fetch_add(&next_stripe, 1, __ATOMIC_RELAXED) & (GRACE_STRIPES - 1);
+	idx = __atomic_load_n(&phase, __ATOMIC_SEQ_CST) & 1;
+	__atomic_fetch_add(&readers[stripe].count[idx], 1, __ATOMIC_SEQ_CST);
+	return stripe << 1 | idx;
+}
+
+void grace_leave(unsigned token) {
+	__atomic_fetch_sub(&readers[token >> 1].count[token & 1], 1, __ATOMIC_RELEASE);
+}
+
+static void drain(unsigned idx) {
+	struct timespec pause = { 0, 100000 };
+	int i;
+
+	for (i = 0; i < GRACE_STRIPES; i++)
+		while (__atomic_load_n(&readers[i].count[idx], __ATOMIC_SEQ_CST))
+			nanosleep(&pause, NULL);
+}
+
+/* wait until no reader can still use what was replaced before the call */
+void grace_wait(void) {
+	pthread_mutex_lock(&wait_lock);
+	drain(__atomic_fetch_add(&phase, 1, __ATOMIC_SEQ_CST) & 1);
+	drain(__atomic_fetch_add(&phase, 1, __ATOMIC_SEQ_CST) & 1);
+	pthread_mutex_unlock(&wait_lock);
+}
+
+/* forget readers of other threads, in a child after fork() */
+void grace_reset(void) {
+	int i;
+
+	for (i = 0; i < GRACE_STRIPES; i++)
+		readers[i].count[0] = readers[i].count[1] = 0;
+	pthread_mutex_init(&wait_lock, NULL);
+}
@@ -0,0 +1,15 @@
+#ifndef GRACE_H
+#define GRACE_H
+
+/*
+ * Grace periods for data that readers use without locking, like RCU:
+ * readers bracket their use with grace_enter/grace_leave, a writer
+ * publishes a new version, calls grace_wait and then frees the old one.
+ */
+
+unsigned grace_enter(void);
+void grace_leave(unsigned token);
+void grace_wait(void);
+void grace_reset(void);
+
+#endif				/* GRACE_H */
@@ -19,8 +19,22 @@ void BrokenMD5Update(struct MD5Context *, unsigned const char *, unsigned);
 void BrokenMD5Final(unsigned char digest[16], struct MD5Context *);
 void BrokenMD5Transform(uint32_t buf[4], uint32_t const in[16]);
 
+#define MD5_LANES 16
+typedef uint32_t md5_lanes __attribute__((vector_size(MD5_LANES * sizeof(uint32_t))));
+
+void GoodMD5TransformMulti(md5_lanes buf[4], md5_lanes const in[16]);
+void BrokenMD5TransformMulti(md5_lanes buf[4], md5_lanes const in[16]);
+
+#define MD5_CRYPT_OUTPUT_SIZE 120
+
 char *Goodcrypt_md5(const char *pw, const char *salt);
 char *Brokencrypt_md5(const char *pw, const char *salt);
+char *Goodcrypt_md5_r(const char *pw, const char *salt, char *passwd);
+char *Brokencrypt_md5_r(const char *pw, const char *salt, char *passwd);
+void Goodcrypt_md5_multi(int n, const char *const pw[], const char *const salt[],
+			 char (*passwd)[MD5_CRYPT_OUTPUT_SIZE]);
+void Brokencrypt_md5_multi(int n, const char *const pw[], const char *const salt[],
+			   char (*passwd)[MD5_CRYPT_OUTPUT_SIZE]);
 
 /*
  * This is needed to make RSAREF happy on some MS-DOS compilers.
@@ -10,6 +10,7 @@
  *
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include "md5.h"
 
@@ -25,22 +26,18 @@ static void to64(char *s, unsigned long v, int n)
 }
 
 /*
- * UNIX password
- *
- * Use MD5 for what it is best at...
+ * First part of crypt_md5: the initial digest of password and salt.
+ * Writes "$1$<salt>$" to passwd and returns the salt in *sp and *sl.
  */
-
-char *MD5Name(crypt_md5)(const char *pw, const char *salt)
+static void MD5Name(crypt_md5_prepare)(const char *pw, const char *salt, char *passwd,
+				       unsigned char final[16], const char **spp, int *slp)
 {
 	const char *magic = "$1$";
 	/* This string is magic for this algorithm.  Having
 	 * it this way, we can get get better later on */
-	static char passwd[120], *p;
-	static const char *sp, *ep;
-	unsigned char final[16];
+	const char *sp, *ep;
 	int sl, pl, i, j;
 	MD5_CTX ctx, ctx1;
-	unsigned long l;
 
 	/* Refine the Salt first */
 	sp = salt;
@@ -77,7 +74,7 @@ char *MD5Name(crypt_md5)(const char *pw, const char *salt)
 		MD5Name(MD5Update)(&ctx,(unsigned const char *)final,pl>16 ? 16 : pl);
 
 	/* Don't leave anything around in vm they could use. */
-	memset(final, 0, sizeof final);
+	memset(final, 0, 16);
 
 	/* Then something really weird... */
 	for (j = 0, i = strlen(pw); i; i >>= 1)
@@ -93,6 +90,58 @@ char *MD5Name(crypt_md5)(const char *pw, const char *salt)
 
 	MD5Name(MD5Final)(final,&ctx);
 
+	*spp = sp;
+	*slp = sl;
+}
+
+/* Last part of crypt_md5: append the encoded digest to passwd. */
+static void MD5Name(crypt_md5_finish)(char *passwd, unsigned char final[16])
+{
+	char *p;
+	unsigned long l;
+
+	p = passwd + strlen(passwd);
+
+	l = (final[0] << 16) | (final[6] << 8) | final[12];
+	to64(p, l, 4);
+	p += 4;
+	l = (final[1] << 16) | (final[7] << 8) | final[13];
+	to64(p, l, 4);
+	p += 4;
+	l = (final[2] << 16) | (final[8] << 8) | final[14];
+	to64(p, l, 4);
+	p += 4;
+	l = (final[3] << 16) | (final[9] << 8) | final[15];
+	to64(p, l, 4);
+	p += 4;
+	l = (final[4] << 16) | (final[10] << 8) | final[5];
+	to64(p, l, 4);
+	p += 4;
+	l = final[11];
+	to64(p, l, 2);
+	p += 2;
+	*p = '\0';
+
+	/* Don't leave anything around in vm they could use. */
+	memset(final, 0, 16);
+}
+
+/*
+ * UNIX password
+ *
+ * Use MD5 for what it is best at...
+ * The result is written to passwd, MD5_CRYPT_OUTPUT_SIZE bytes.
+ */
+
+char *MD5Name(crypt_md5_r)(const char *pw, const char *salt, char *passwd)
+{
+	const char *sp;
+	unsigned char final[16];
+	int sl, i;
+	MD5_CTX ctx1;
+
+	MD5Name(crypt_md5_prepare)(pw, salt, passwd, final, &sp, &sl);
+
 	/*
 	 * and now, just to make sure things don't run too fast
 	 * On a 60 Mhz Pentium this takes 34 msec, so you would
@@ -118,30 +167,182 @@ char *MD5Name(crypt_md5)(const char *pw, const char *salt)
 		MD5Name(MD5Final)(final,&ctx1);
 	}
 
-	p = passwd + strlen(passwd);
+	MD5Name(crypt_md5_finish)(passwd, final);
 
-	l = (final[0] << 16) | (final[6] << 8) | final[12];
-	to64(p, l, 4);
-	p += 4;
-	l = (final[1] << 16) | (final[7] << 8) | final[13];
-	to64(p, l, 4);
-	p += 4;
-	l = (final[2] << 16) | (final[8] << 8) | final[14];
-	to64(p, l, 4);
-	p += 4;
-	l = (final[3] << 16) | (final[9] << 8) | final[15];
-	to64(p, l, 4);
-	p += 4;
-	l = (final[4] << 16) | (final[10] << 8) | final[5];
-	to64(p, l, 4);
-	p += 4;
-	l = final[11];
-	to64(p, l, 2);
-	p += 2;
-	*p = '\0';
+	return passwd;
+}
+
+char *MD5Name(crypt_md5)(const char *pw, const char *salt)
+{
+	static char passwd[MD5_CRYPT_OUTPUT_SIZE];
+
+	return MD5Name(crypt_md5_r)(pw, salt, passwd);
+}
+
+/*
+ * crypt_md5 for many passwords, MD5_LANES at a time through
+ * MD5TransformMulti.  The 1000 rounds repeat their message layout every
+ * 42 rounds, so each lane gets 42 prepared and padded messages with
+ * password, salt and length already in place; a round only inserts the
+ * previous digest and hashes the blocks of all lanes together.
+ * Passwords too long for MULTI_MAXBLOCKS blocks take the scalar path.
+ */
+
+#define MULTI_ROUNDS	42	/* lcm(2, 3, 7) */
+#define MULTI_MAXBLOCKS	3
+#define MULTI_MAXPW	((MULTI_MAXBLOCKS * 64 - 9 - 16 - 8) / 2)
+
+#ifdef HIGHFIRST
+#define LOAD32(p)	((uint32_t) (p)[0] << 24 | (uint32_t) (p)[1] << 16 | (uint32_t) (p)[2] << 8 | (p)[3])
+#define STORE32(p, v)	((p)[0] = (v) >> 24, (p)[1] = (v) >> 16, (p)[2] = (v) >> 8, (p)[3] = (v))
+#else
+#define LOAD32(p)	((uint32_t) (p)[3] << 24 | (uint32_t) (p)[2] << 16 | (uint32_t) (p)[1] << 8 | (p)[0])
+#define STORE32(p, v)	((p)[3] = (v) >> 24, (p)[2] = (v) >> 16, (p)[1] = (v) >> 8, (p)[0] = (v))
+#endif
+
+struct multi_round {
+	unsigned char msg[MULTI_MAXBLOCKS * 64];
+	uint32_t words[MULTI_MAXBLOCKS * 16];	/* msg as loaded by MD5 */
+	int final_off;		/* where the previous digest goes */
+	int nblocks;
+};
+
+static void MD5Name(multi_layout)(struct multi_round r[MULTI_ROUNDS], const char *pw, const char *sp, int sl)
+{
+	int i, j, pl = strlen(pw);
+
+	for (i = 0; i < MULTI_ROUNDS; i++) {
+		unsigned char *m = r[i].msg;
+		int len = 0;
+
+		memset(m, 0, sizeof(r[i].msg));
+		if (i & 1) {
+			memcpy(m + len, pw, pl);
+			len += pl;
+		} else {
+			r[i].final_off = len;
+			len += 16;
+		}
+		if (i % 3) {
+			memcpy(m + len, sp, sl);
+			len += sl;
+		}
+		if (i % 7) {
+			memcpy(m + len, pw, pl);
+			len += pl;
+		}
+		if (i & 1) {
+			r[i].final_off = len;
+			len += 16;
+		} else {
+			memcpy(m + len, pw, pl);
+			len += pl;
+		}
+		m[len] = 0x80;
+		r[i].nblocks = (len + 8) / 64 + 1;
+
+		for (j = 0; j < r[i].nblocks * 16; j++)
+			r[i].words[j] = LOAD32(m + 4 * j);
+		/* the length is a number, not bytes */
+		r[i].words[r[i].nblocks * 16 - 2] = len << 3;
+		r[i].words[r[i].nblocks * 16 - 1] = 0;
+	}
+}
+
+static void MD5Name(multi_run)(int k, const char *const pw[], const char *const salt[],
+			       char (*passwd)[MD5_CRYPT_OUTPUT_SIZE], struct multi_round (*layout)[MULTI_ROUNDS])
+{
+	static const uint32_t init[4] = { 0x67452301U, 0xefcdab89U, 0x98badcfeU, 0x10325476U };
+	unsigned char final[MD5_LANES][16];
+	md5_lanes state[4], next[4], in[16], active;
+	int lane, i, b, j;
+
+	for (lane = 0; lane < MD5_LANES; lane++) {
+		const char *sp;
+		int sl;
+
+		if (lane >= k) {
+			/* idle lane, hash something harmless */
+			MD5Name(multi_layout)(layout[lane], "", "", 0);
+			memset(final[lane], 0, 16);
+			continue;
+		}
+		MD5Name(crypt_md5_prepare)(pw[lane], salt[lane], passwd[lane], final[lane], &sp, &sl);
+		MD5Name(multi_layout)(layout[lane], pw[lane], sp, sl);
+	}
+
+	for (i = 0; i < 1000; i++) {
+		struct multi_round *r;
+		int nblocks = 0;
+
+		for (lane = 0; lane < MD5_LANES; lane++) {
+			r = &layout[lane][i % MULTI_ROUNDS];
+			memcpy(r->msg + r->final_off, final[lane], 16);
+			/* only the words covering the digest change */
+			for (j = r->final_off / 4; j <= (r->final_off + 15) / 4; j++)
+				r->words[j] = LOAD32(r->msg + 4 * j);
+			if (r->nblocks > nblocks)
+				nblocks = r->nblocks;
+		}
+
+		for (j = 0; j < 4; j++)
+			state[j] = (md5_lanes) {} + init[j];
+		for (b = 0; b < nblocks; b++) {
+			for (lane = 0; lane < MD5_LANES; lane++) {
+				r = &layout[lane][i % MULTI_ROUNDS];
+				for (j = 0; j < 16; j++)
+					in[j][lane] = r->words[16 * b + j];
+				active[lane] = b < r->nblocks ? ~0U : 0;
+			}
+			for (j = 0; j < 4; j++)
+				next[j] = state[j];
+			MD5Name(MD5TransformMulti)(next, in);
+			for (j = 0; j < 4; j++)
+				state[j] = (next[j] & active) | (state[j] & ~active);
+		}
+
+		for (lane = 0; lane < MD5_LANES; lane++)
+			for (j = 0; j < 4; j++)
+				STORE32(final[lane] + 4 * j, state[j][lane]);
+	}
+
+	for (lane = 0; lane < k; lane++)
+		MD5Name(crypt_md5_finish)(passwd[lane], final[lane]);
 
 	/* Don't leave anything around in vm they could use. */
-	memset(final, 0, sizeof final);
+	memset(layout, 0, MD5_LANES * sizeof(*layout));
+	memset(final, 0, sizeof(final));
+	memset(in, 0, sizeof(in));
+}
 
-	return passwd;
+void MD5Name(crypt_md5_multi)(int n, const char *const pw[], const char *const salt[],
+			      char (*passwd)[MD5_CRYPT_OUTPUT_SIZE])
+{
+	struct multi_round (*layout)[MULTI_ROUNDS] = malloc(MD5_LANES * sizeof(*layout));
+	const char *lane_pw[MD5_LANES], *lane_salt[MD5_LANES];
+	char (*lane_out[MD5_LANES])[MD5_CRYPT_OUTPUT_SIZE];
+	char out[MD5_LANES][MD5_CRYPT_OUTPUT_SIZE];
+	int i, k = 0, lane;
+
+	for (i = 0; i < n; i++) {
+		if (!layout || strlen(pw[i]) > MULTI_MAXPW) {
+			MD5Name(crypt_md5_r)(pw[i], salt[i], passwd[i]);
+			continue;
+		}
+		lane_pw[k] = pw[i];
+		lane_salt[k] = salt[i];
+		lane_out[k++] = &passwd[i];
+		if (k == MD5_LANES) {
+			MD5Name(multi_run)(k, lane_pw, lane_salt, out, layout);
+			for (lane = 0; lane < k; lane++)
+				memcpy(*lane_out[lane], out[lane], MD5_CRYPT_OUTPUT_SIZE);
+			k = 0;
+		}
+	}
+	if (k) {
+		MD5Name(multi_run)(k, lane_pw, lane_salt, out, layout);
+		for (lane = 0; lane < k; lane++)
+			memcpy(*lane_out[lane], out[lane], MD5_CRYPT_OUTPUT_SIZE);
+	}
+	free(layout);
 }
@@ -0,0 +1,57 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include "pwdfile.h"
+
+/*
+ * What pwdfile_options_parse makes of the module arguments, and the
+ * shared state it attaches. Only the module and the library see this;
+ * programs using libpwdfile get a pointer from pwdfile_options_new.
+ */
+
+struct stats;
+struct failtrack;
+struct admit;
+
+struct pwdfile_options {
+	const char *pwdfilename;
+	const char *indexname;
+	const char *pwdfile_dir;	/* sharded instead of pwdfilename */
+	unsigned shards;
+	int use_flock;
+	unsigned flock_timeout;	/* ms, 0 for the default */
+	int use_snapshot;
+	int use_cache;
+	int use_watch;
+	int use_mmap;
+	int use_sorted;		/* binary search in the mapping, if pwdfile is sorted */
+	const char *shm_tablename;	/* table of pwdfile shared by all processes */
+	unsigned authcache_ttl;
+	int authcache_negative;
+	int use_delay;
+	int legacy_crypt;
+	int builtin_sha;	/* $5$ and $6$ by sha_crypt.c instead of libcrypt */
+	unsigned expire_field;	/* counted from 1 like cut -f, 0 for none */
+	/* rehash= passwords in other schemes after a successful check */
+	const char *rehash_prefix;
+	unsigned long rehash_cost;
+	int debug;
+	struct stats *stats;
+	/* recent failures, checked by pam_sm_authenticate before crypt() */
+	struct failtrack *failtrack;
+	unsigned fail_threshold;
+	unsigned fail_window;	/* s */
+	/* daemon: the socket of pwdfiled, which does the work if it runs */
+	const char *daemon_socket;
+	/* crypt_limit: the memory concurrent checks on this host may take */
+	struct admit *admit;
+	unsigned crypt_wait;	/* ms */
+	/* messages go to syslog(3) unless log is set */
+	pwdfile_log_fn *log;
+	void *log_arg;
+};
+
+/* the defaults, for options that live on the stack of the module */
+void pwdfile_options_init(struct pwdfile_options *opts);
+
+#endif				/* OPTIONS_H */
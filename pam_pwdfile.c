@@ -65,168 +65,228 @@
 #include <security/pam_appl.h>
 
 #define PAM_SM_AUTH
+#define PAM_SM_ACCOUNT
+#define PAM_SM_PASSWORD
 #include <security/pam_modules.h>
 #include <security/pam_ext.h>
 
-#include "md5.h"
-#include "bigcrypt.h"
+#include "pwdfile.h"
+#include "options.h"
+#include "probes.h"
+#include "stats.h"
+#include "failtrack.h"
+#include "pwdproto.h"
 
-static int lock_fd(int fd) {
-    int delay;
+/* the line of the user from authentication, for account management */
+#define RECORD_DATA "pam_pwdfile_record"
+/* how long to wait for an answer of pwdfiled before checking here */
+#define DAEMON_TIMEOUT 15000	/* ms */
+
+static void log_pam(void *pamh, int priority, const char *fmt, va_list ap) {
+    pam_vsyslog(pamh, priority, fmt, ap);
+}
+
+static void free_record(pam_handle_t *pamh, void *data, int error_status) {
+    free(data);
+}
+
+/* too many recent failures of the user or the remote host */
+static int too_many_failures(pam_handle_t *pamh, const struct pwdfile_options *opts,
+			     const char *name, const char *rhost) {
+    unsigned count;
     
-    for (delay = 5; delay <= 40; delay *= 2) {
-	if (flock(fd, LOCK_SH | LOCK_NB) == -1) {
-	    /* failed */
-	    if (errno != EWOULDBLOCK) goto failed;
-	    sleep(delay);
-	}else{
-	    return 0;
-	}
+    count = failtrack_count(opts->failtrack, failtrack_key(FAILTRACK_USER, name), opts->fail_window);
+    if (count >= opts->fail_threshold) {
+	pam_syslog(pamh, LOG_NOTICE, "%u recent failures for user %s, not checking password", count, name);
+	return 1;
+    }
+    if (!rhost)
+	return 0;
+    count = failtrack_count(opts->failtrack, failtrack_key(FAILTRACK_HOST, rhost), opts->fail_window);
+    if (count >= opts->fail_threshold) {
+	pam_syslog(pamh, LOG_NOTICE, "%u recent failures from %s, not checking password", count, rhost);
+	return 1;
     }
-    if (flock(fd, LOCK_SH | LOCK_NB) != -1) return 0;
-    failed:
+    return 0;
+}
+
+/*
+ * a connection to pwdfiled if daemon= is set and it runs as root or as
+ * the owner of pwdfile, else -1 to do the work here
+ */
+static int daemon_connect(pam_handle_t *pamh, const struct pwdfile_options *opts) {
+    const char *pwdfile = opts->pwdfile_dir ? opts->pwdfile_dir : opts->pwdfilename;
+    struct stat st;
+    int fd;
+    
+    if (!opts->daemon_socket)
+	return -1;
+    if ((fd = pwdproto_connect(opts->daemon_socket, pwdfile && stat(pwdfile, &st) == 0 ? st.st_uid : 0)) != -1)
+	return fd;
+    if (errno == EPERM)
+	pam_syslog(pamh, LOG_ERR, "pwdfiled at %s isn't run by root or the owner of %s, checking here",
+		   opts->daemon_socket, pwdfile ? pwdfile : "pwdfile");
+    else if (opts->debug)
+	pam_syslog(pamh, LOG_DEBUG, "no pwdfiled at %s, checking here: %m", opts->daemon_socket);
     return -1;
 }
 
-/* expected hook for auth service */
-__attribute__((visibility("default")))
-PAM_EXTERN int pam_sm_authenticate(pam_handle_t *pamh, int flags,
-				   int argc, const char **argv) {
-    int i;
+static int daemon_ask(pam_handle_t *pamh, const struct pwdfile_options *opts, int fd, enum pwdproto_op op,
+		      const char *name, const char *password, struct pwdproto_response *response) {
+    if (pwdproto_ask(fd, op, name, password, response, DAEMON_TIMEOUT) == 0)
+	return 0;
+    pam_syslog(pamh, LOG_ERR, "pwdfiled at %s failed, checking here: %m", opts->daemon_socket);
+    return -1;
+}
+
+/* pwdfile_lookup, and the PAM handle owns the line from then on */
+static enum pwdfile_result lookup_here(pam_handle_t *pamh, const struct pwdfile_options *opts,
+				       const char *name, char **linebuf) {
+    enum pwdfile_result result = pwdfile_lookup(opts, name, linebuf);
+    
+    if (*linebuf && pam_set_data(pamh, RECORD_DATA, *linebuf, free_record) != PAM_SUCCESS) {
+	free(*linebuf);
+	*linebuf = NULL;
+	return PWDFILE_ERROR;
+    }
+    return result;
+}
+
+static int authenticate(pam_handle_t *pamh, int flags, const struct pwdfile_options *opts) {
     const char *name;
+    const void *rhost = NULL;
     char const * password;
-    char const * pwdfilename = NULL;
-    char const * stored_crypted_password = NULL;
-    char const * crypted_password;
-    FILE *pwdfile;
-    int use_flock = 0;
-    int use_delay = 1;
-    int legacy_crypt = 0;
-    int debug = 0;
+    const char * crypted;
     char * linebuf = NULL;
-    size_t linebuflen;
-#ifdef USE_CRYPT_R
-    struct crypt_data crypt_buf;
-#endif
-    
-    /* we require the pwdfile switch and argument to be present, else we don't work */
-    for (i = 0; i < argc; ++i) {
-	if (!strcmp(argv[i], "pwdfile") && i + 1 < argc)
-	    pwdfilename = argv[++i];
-	else if (!strncmp(argv[i], "pwdfile=", strlen("pwdfile=")))
-	    pwdfilename = argv[i] + strlen("pwdfile=");
-	else if (!strcmp(argv[i], "flock"))
-	    use_flock = 1;
-	else if (!strcmp(argv[i], "noflock"))
-	    use_flock = 0;
-	else if (!strcmp(argv[i], "nodelay"))
-	    use_delay = 0;
-	else if (!strcmp(argv[i], "debug"))
-	    debug = 1;
-	else if (!strcmp(argv[i], "legacy_crypt"))
-	    legacy_crypt = 1;
-    }
+    struct pwdproto_response response;
+    enum pwdfile_result result;
+    int retval, empty, fd;
     
 #ifdef HAVE_PAM_FAIL_DELAY
-    if (use_delay) {
-	if (debug) pam_syslog(pamh, LOG_DEBUG, "setting fail delay");
+    if (opts->use_delay) {
+	if (opts->debug) pam_syslog(pamh, LOG_DEBUG, "setting fail delay");
 	(void) pam_fail_delay(pamh, 2000000);   /* 2 sec */
     }
 #endif
     
-    if (!pwdfilename) {
-	pam_syslog(pamh, LOG_ERR, "password file name not specified");
-	return PAM_AUTHINFO_UNAVAIL;
-    }
-    
     if (pam_get_user(pamh, &name, NULL) != PAM_SUCCESS) {
 	pam_syslog(pamh, LOG_ERR, "couldn't get username from PAM stack");
 	return PAM_AUTH_ERR;
     }
-    if (debug) pam_syslog(pamh, LOG_DEBUG, "username is %s", name);
+    if (opts->debug) pam_syslog(pamh, LOG_DEBUG, "username is %s", name);
+    PROBE1(auth__start, name);
     
-    if (!(pwdfile = fopen(pwdfilename, "r"))) {
-	pam_syslog(pamh, LOG_ALERT, "couldn't open password file %s", pwdfilename);
-	return PAM_AUTHINFO_UNAVAIL;
+    if ((fd = daemon_connect(pamh, opts)) != -1
+	&& daemon_ask(pamh, opts, fd, PWDPROTO_LOOKUP, name, "", &response) == -1) {
+	close(fd);
+	fd = -1;
     }
-    
-    if (use_flock && lock_fd(fileno(pwdfile)) == -1) {
-	pam_syslog(pamh, LOG_ALERT, "couldn't lock password file %s", pwdfilename);
-	fclose(pwdfile);
-	return PAM_AUTHINFO_UNAVAIL;
+    if (fd != -1) {
+	result = response.result;
+	empty = response.empty;
+    } else {
+	result = lookup_here(pamh, opts, name, &linebuf);
+	empty = linebuf && !pwdfile_crypted(linebuf, &crypted);
     }
-    
-    /* get the crypted password corresponding to this user out of pwdfile */
-    while (getline(&linebuf, &linebuflen, pwdfile) > 0) {
-	/* strsep changes its argument, make a copy */
-	char * nexttok = linebuf;
-	
-	/* first field: username */
-	char * curtok = strsep(&nexttok, ":");
-	
-	/* skip non-matching usernames */
-	if (strcmp(curtok, name))
-	    continue;
-	
-	/* second field: password (until next colon or newline) */
-	if ((curtok = strsep(&nexttok, ":\n"))) {
-	    stored_crypted_password = curtok;
-	    break;
-	}
+    switch (result) {
+    case PWDFILE_OK:
+    case PWDFILE_UNKNOWN:
+	break;
+    case PWDFILE_UNAVAIL:
+	retval = PAM_AUTHINFO_UNAVAIL;
+	goto out;
+    default:
+	retval = PAM_BUF_ERR;
+	goto out;
     }
-    fclose(pwdfile);
-    /* we keep linebuf (allocated by getline), stored_crypted_password is pointing into it */
-
-    if (!stored_crypted_password)
-	if (debug) pam_syslog(pamh, LOG_ERR, "user not found in password database");
     
-    if (stored_crypted_password && !strlen(stored_crypted_password)) {
-	if (debug) pam_syslog(pamh, LOG_DEBUG, "user has empty password field");
-	free(linebuf);
-	return flags & PAM_DISALLOW_NULL_AUTHTOK ? PAM_AUTH_ERR : PAM_SUCCESS;
+    if (empty) {
+	if (opts->debug) pam_syslog(pamh, LOG_DEBUG, "user has empty password field");
+	retval = flags & PAM_DISALLOW_NULL_AUTHTOK ? PAM_AUTH_ERR : PAM_SUCCESS;
+	goto out;
     }
     
-    if (pam_get_authtok(pamh, PAM_AUTHTOK, &password, NULL) != PAM_SUCCESS) {
+    /* ask for the password of unknown users too, don't tell them apart */
+    PROBE0(authtok__start);
+    retval = pam_get_authtok(pamh, PAM_AUTHTOK, &password, NULL);
+    PROBE1(authtok__done, retval);
+    if (retval != PAM_SUCCESS) {
 	pam_syslog(pamh, LOG_ERR, "couldn't get password from PAM stack");
-	free(linebuf);
-	return PAM_AUTH_ERR;
+	retval = PAM_AUTH_ERR;
+	goto out;
     }
     
-    if (!stored_crypted_password) {
-	free(linebuf);
-	return PAM_USER_UNKNOWN;
+    if (opts->failtrack) {
+	(void) pam_get_item(pamh, PAM_RHOST, &rhost);
+	if (rhost && !*(const char *) rhost)
+	    rhost = NULL;
+	if (too_many_failures(pamh, opts, name, rhost)) {
+	    retval = PAM_MAXTRIES;
+	    goto out;
+	}
     }
     
-    if (debug) pam_syslog(pamh, LOG_DEBUG, "got crypted password == '%s'", stored_crypted_password);
-    
-#ifdef USE_CRYPT_R
-    crypt_buf.initialized = 0;
-    if (!(crypted_password = crypt_r(password, stored_crypted_password, &crypt_buf)))
-#else
-    if (!(crypted_password = crypt(password, stored_crypted_password)))
-#endif
-    {
-	pam_syslog(pamh, LOG_ERR, "crypt() failed");
-	free(linebuf);
-	return PAM_AUTH_ERR;
+    if (result == PWDFILE_UNKNOWN) {
+	/* guessing user names is counted against the host only */
+	if (opts->failtrack && rhost)
+	    failtrack_fail(opts->failtrack, failtrack_key(FAILTRACK_HOST, rhost), opts->fail_window);
+	retval = PAM_USER_UNKNOWN;
+	goto out;
     }
     
-    if (legacy_crypt && strcmp(crypted_password, stored_crypted_password)) {
-	if (!strncmp(stored_crypted_password, "$1$", 3))
-	    crypted_password = Brokencrypt_md5(password, stored_crypted_password);
-	else
-	    crypted_password = bigcrypt(password, stored_crypted_password);
+    if (fd != -1 && daemon_ask(pamh, opts, fd, PWDPROTO_VERIFY, name, password, &response) == 0)
+	result = response.result;
+    /* if pwdfiled went away after the lookup, look the user up here */
+    else if (linebuf || (result = lookup_here(pamh, opts, name, &linebuf)) == PWDFILE_OK)
+	result = pwdfile_check(opts, name, linebuf, password);
+    if (result == PWDFILE_UNAVAIL) {
+	retval = PAM_AUTHINFO_UNAVAIL;
+	goto out;
     }
-
-    if (strcmp(crypted_password, stored_crypted_password)) {
-	pam_syslog(pamh, LOG_NOTICE, "wrong password for user %s", name);
-	free(linebuf);
-	return PAM_AUTH_ERR;
+    retval = result == PWDFILE_OK ? PAM_SUCCESS : PAM_AUTH_ERR;
+    if (opts->failtrack) {
+	if (result == PWDFILE_OK)
+	    failtrack_clear(opts->failtrack, failtrack_key(FAILTRACK_USER, name));
+	else if (result == PWDFILE_WRONG) {
+	    failtrack_fail(opts->failtrack, failtrack_key(FAILTRACK_USER, name), opts->fail_window);
+	    if (rhost)
+		failtrack_fail(opts->failtrack, failtrack_key(FAILTRACK_HOST, rhost), opts->fail_window);
+	}
     }
+out:
+    if (fd != -1)
+	close(fd);
+    return retval;
+}
+
+/* expected hook for auth service */
+__attribute__((visibility("default")))
+PAM_EXTERN int pam_sm_authenticate(pam_handle_t *pamh, int flags,
+				   int argc, const char **argv) {
+    struct pwdfile_options opts;
+    const void *user = NULL;
+    int retval;
     
-    if (debug) pam_syslog(pamh, LOG_DEBUG, "passwords match");
-    free(linebuf);
-    return PAM_SUCCESS;
+    pwdfile_options_init(&opts);
+    opts.log = log_pam;
+    opts.log_arg = pamh;
+    pwdfile_options_parse(&opts, argc, argv);
+    retval = authenticate(pamh, flags, &opts);
+    
+    (void) pam_get_item(pamh, PAM_USER, &user);
+    PROBE2(auth__done, (const char *) user, retval);
+    if (opts.stats) {
+	enum stats_outcome outcome;
+	switch (retval) {
+	case PAM_SUCCESS: outcome = STATS_SUCCESS; break;
+	case PAM_AUTH_ERR: outcome = STATS_WRONG; break;
+	case PAM_USER_UNKNOWN: outcome = STATS_UNKNOWN; break;
+	case PAM_AUTHINFO_UNAVAIL: outcome = STATS_UNAVAIL; break;
+	default: outcome = STATS_OTHER; break;
+	}
+	stats_add(&opts.stats->outcomes[outcome], 1);
+    }
+    return retval;
 }
 
 /* another expected hook */
@@ -237,15 +297,165 @@ PAM_EXTERN int pam_sm_setcred(pam_handle_t *pamh, int flags,
     return PAM_SUCCESS;
 }
 
+/* expected hook for account service: optional expiry and locked entries */
+__attribute__((visibility("default")))
+PAM_EXTERN int pam_sm_acct_mgmt(pam_handle_t *pamh, int flags,
+				int argc, const char **argv) {
+    struct pwdfile_options opts;
+    const char *name;
+    const void *record = NULL;
+    char *linebuf = NULL;
+    struct pwdproto_response response;
+    enum pwdfile_result result;
+    enum pwdfile_account account = PWDFILE_ACCOUNT_OK;
+    size_t len;
+    int fd = -1;
+    
+    pwdfile_options_init(&opts);
+    opts.log = log_pam;
+    opts.log_arg = pamh;
+    pwdfile_options_parse(&opts, argc, argv);
+    
+    if (pam_get_user(pamh, &name, NULL) != PAM_SUCCESS) {
+	pam_syslog(pamh, LOG_ERR, "couldn't get username from PAM stack");
+	return PAM_USER_UNKNOWN;
+    }
+    
+    /* the line read during authentication, unless that was another module or another user */
+    len = strlen(name);
+    if (pam_get_data(pamh, RECORD_DATA, &record) == PAM_SUCCESS
+	&& !strncmp(record, name, len) && ((const char *) record)[len] == ':') {
+	if (opts.debug) pam_syslog(pamh, LOG_DEBUG, "using the entry read during authentication");
+	result = PWDFILE_OK;
+	account = pwdfile_account(&opts, record);
+    } else if ((fd = daemon_connect(pamh, &opts)) != -1
+	       && daemon_ask(pamh, &opts, fd, PWDPROTO_LOOKUP, name, "", &response) == 0) {
+	result = response.result;
+	account = response.account;
+    } else if ((result = pwdfile_lookup(&opts, name, &linebuf)) == PWDFILE_OK) {
+	account = pwdfile_account(&opts, linebuf);
+	free(linebuf);
+    }
+    if (fd != -1)
+	close(fd);
+    
+    switch (result) {
+    case PWDFILE_OK:
+	break;
+    case PWDFILE_UNKNOWN:
+	return PAM_USER_UNKNOWN;
+    case PWDFILE_UNAVAIL:
+	return PAM_AUTHINFO_UNAVAIL;
+    default:
+	return PAM_BUF_ERR;
+    }
+    switch (account) {
+    case PWDFILE_ACCOUNT_OK:
+	return PAM_SUCCESS;
+    case PWDFILE_ACCOUNT_EXPIRED:
+	return PAM_ACCT_EXPIRED;
+    default:
+	return PAM_PERM_DENIED;
+    }
+}
+
+/*
+ * expected hook for password service: the preliminary check asks users
+ * other than root for their old password, and root too when an expired
+ * password has to be changed, like pam_unix; the update writes the new one
+ */
+__attribute__((visibility("default")))
+PAM_EXTERN int pam_sm_chauthtok(pam_handle_t *pamh, int flags,
+				int argc, const char **argv) {
+    struct pwdfile_options opts;
+    const char *name, *password, *crypted;
+    char *linebuf, *old;
+    size_t len;
+    enum pwdfile_result result;
+    int retval;
+    
+    pwdfile_options_init(&opts);
+    opts.log = log_pam;
+    opts.log_arg = pamh;
+    pwdfile_options_parse(&opts, argc, argv);
+    
+    if (pam_get_user(pamh, &name, NULL) != PAM_SUCCESS) {
+	pam_syslog(pamh, LOG_ERR, "couldn't get username from PAM stack");
+	return PAM_USER_UNKNOWN;
+    }
+    /* read again, pwdfile may have changed since authentication */
+    switch (pwdfile_lookup(&opts, name, &linebuf)) {
+    case PWDFILE_OK:
+	break;
+    case PWDFILE_UNKNOWN:
+	return PAM_USER_UNKNOWN;
+    case PWDFILE_UNAVAIL:
+	return PAM_AUTHINFO_UNAVAIL;
+    default:
+	return PAM_BUF_ERR;
+    }
+    
+    if (flags & PAM_PRELIM_CHECK) {
+	retval = PAM_SUCCESS;
+	if ((getuid() != 0 || flags & PAM_CHANGE_EXPIRED_AUTHTOK) && pwdfile_crypted(linebuf, &crypted)) {
+	    if (pam_get_authtok(pamh, PAM_OLDAUTHTOK, &password, NULL) != PAM_SUCCESS)
+		retval = PAM_AUTHTOK_ERR;
+	    else if ((result = pwdfile_check(&opts, name, linebuf, password)) == PWDFILE_UNAVAIL)
+		retval = PAM_TRY_AGAIN;
+	    else if (result != PWDFILE_OK)
+		retval = PAM_AUTH_ERR;
+	}
+	free(linebuf);
+	return retval;
+    }
+    if (!(flags & PAM_UPDATE_AUTHTOK)) {
+	free(linebuf);
+	return PAM_SERVICE_ERR;
+    }
+    
+    len = pwdfile_crypted(linebuf, &crypted);
+    old = strndup(crypted, len);
+    free(linebuf);
+    if (!old)
+	return PAM_BUF_ERR;
+    if (pam_get_authtok(pamh, PAM_AUTHTOK, &password, NULL) != PAM_SUCCESS) {
+	pam_syslog(pamh, LOG_ERR, "couldn't get new password from PAM stack");
+	free(old);
+	return PAM_AUTHTOK_ERR;
+    }
+    
+    switch (pwdfile_change(&opts, name, old, password)) {
+    case PWDFILE_OK:
+	retval = PAM_SUCCESS;
+	break;
+    case PWDFILE_WRONG:
+	/* somebody else changed it since it was read */
+	retval = PAM_TRY_AGAIN;
+	break;
+    case PWDFILE_UNKNOWN:
+	retval = PAM_USER_UNKNOWN;
+	break;
+    case PWDFILE_UNAVAIL:
+	/* couldn't open or lock pwdfile */
+	retval = PAM_AUTHTOK_LOCK_BUSY;
+	break;
+    default:
+	retval = PAM_AUTHTOK_ERR;
+	break;
+    }
+    free(old);
+    return retval;
+}
+
 #ifdef PAM_STATIC
 struct pam_module _pam_listfile_modstruct = {
     "pam_pwdfile",
 	pam_sm_authenticate,
 	pam_sm_setcred,
+	pam_sm_acct_mgmt,
 	NULL,
 	NULL,
-	NULL,
-	NULL,
+	pam_sm_chauthtok,
 };
 #endif
 /* vim:set ts=8 sw=4: */
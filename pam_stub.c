@@ -0,0 +1,108 @@
+/*
+ * Stub implementations of the libpam functions pam_pwdfile uses, see
+ * pam_stub.h.
+ *
+ * This file may be distributed under the same terms as pam_pwdfile.c.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include <security/pam_appl.h>
+#include <security/pam_modules.h>
+#include <security/pam_ext.h>
+
+#include "pam_stub.h"
+
+int pam_get_user(pam_handle_t *pamh, const char **user, const char *prompt) {
+	if (!pamh->user)
+		return PAM_USER_UNKNOWN;
+	*user = pamh->user;
+	return PAM_SUCCESS;
+}
+
+int pam_get_authtok(pam_handle_t *pamh, int item, const char **authtok, const char *prompt) {
+	if (!pamh->authtok)
+		return PAM_AUTH_ERR;
+	*authtok = pamh->authtok;
+	return PAM_SUCCESS;
+}
+
+int pam_get_item(const pam_handle_t *pamh, int item_type, const void **item) {
+	switch (item_type) {
+	case PAM_USER:
+		*item = pamh->user;
+		return PAM_SUCCESS;
+	case PAM_AUTHTOK:
+		*item = pamh->authtok;
+		return PAM_SUCCESS;
+	case PAM_RHOST:
+		*item = pamh->rhost;
+		return PAM_SUCCESS;
+	default:
+		*item = NULL;
+		return PAM_BAD_ITEM;
+	}
+}
+
+int pam_set_data(pam_handle_t *pamh, const char *name, void *data,
+		 void (*cleanup)(pam_handle_t *pamh, void *data, int error_status)) {
+	int i, free_slot = -1;
+
+	for (i = 0; i < PAM_STUB_MAX_DATA; i++) {
+		if (pamh->data[i].name && !strcmp(pamh->data[i].name, name)) {
+			if (pamh->data[i].cleanup)
+				pamh->data[i].cleanup(pamh, pamh->data[i].data, 0);
+			break;
+		}
+		if (!pamh->data[i].name && free_slot == -1)
+			free_slot = i;
+	}
+	if (i == PAM_STUB_MAX_DATA && (i = free_slot) == -1)
+		return PAM_BUF_ERR;
+	pamh->data[i].name = name;
+	pamh->data[i].data = data;
+	pamh->data[i].cleanup = cleanup;
+	return PAM_SUCCESS;
+}
+
+int pam_get_data(const pam_handle_t *pamh, const char *name, const void **data) {
+	int i;
+
+	for (i = 0; i < PAM_STUB_MAX_DATA; i++)
+		if (pamh->data[i].name && !strcmp(pamh->data[i].name, name)) {
+			*data = pamh->data[i].data;
+			return PAM_SUCCESS;
+		}
+	return PAM_NO_MODULE_DATA;
+}
+
+int pam_fail_delay(pam_handle_t *pamh, unsigned int usec) {
+	return PAM_SUCCESS;
+}
+
+void pam_vsyslog(const pam_handle_t *pamh, int priority, const char *fmt, va_list ap) {
+	if (!pamh || !pamh->verbose)
+		return;
+	vfprintf(stderr, fmt, ap);
+	fputc('\n', stderr);
+}
+
+void pam_syslog(const pam_handle_t *pamh, int priority, const char *fmt, ...) {
+	va_list ap;
+
+	va_start(ap, fmt);
+	pam_vsyslog(pamh, priority, fmt, ap);
+	va_end(ap);
+}
+
+/* like pam_end(): run the cleanup functions of pam_set_data */
+void pam_stub_end(pam_handle_t *pamh) {
+	int i;
+
+	for (i = 0; i < PAM_STUB_MAX_DATA; i++)
+		if (pamh->data[i].name && pamh->data[i].cleanup)
+			pamh->data[i].cleanup(pamh, pamh->data[i].data, PAM_SUCCESS);
+	memset(pamh->data, 0, sizeof(pamh->data));
+}
@@ -0,0 +1,25 @@
+#ifndef PAM_STUB_H
+#define PAM_STUB_H
+
+/*
+ * Just enough of libpam to call the module's hooks without a PAM stack,
+ * used by pwdfile_bench.
+ */
+
+#define PAM_STUB_MAX_DATA 8
+
+struct pam_handle {
+	const char *user;
+	const char *authtok;
+	const char *rhost;
+	int verbose;		/* print pam_syslog messages to stderr */
+	struct {
+		const char *name;
+		void *data;
+		void (*cleanup)(struct pam_handle *pamh, void *data, int error_status);
+	} data[PAM_STUB_MAX_DATA];
+};
+
+void pam_stub_end(struct pam_handle *pamh);
+
+#endif				/* PAM_STUB_H */
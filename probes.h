@@ -0,0 +1,44 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/*
+ * USDT probes of provider pam_pwdfile, for bpftrace, perf or systemtap.
+ * An unused probe is a single nop, so they are always compiled in when
+ * <sys/sdt.h> (systemtap-sdt-dev) is available; define NO_SDT to leave
+ * them out.  Probes and their arguments:
+ *
+ * auth__start(user)
+ * auth__done(user, PAM return value)
+ * open__start(path), open__done(path, 0 or errno)
+ * lock__start(path), lock__done(path, 0 or -1)
+ * lookup__start(method), lookup__done(method, found, lines or bytes scanned)
+ * authtok__start(), authtok__done(PAM return value)
+ * authcache__done(0 miss, 1 good, 2 bad)
+ * crypt__start(scheme), crypt__done(scheme, match)
+ * rehash__start(user), rehash__done(1 if pwdfile was updated)
+ *
+ * method is "scan", "mmap", "sorted", "cache", "index", "shm" or "batch", scheme the name
+ * from scheme.c, e.g. "sha512". For "batch", found is the number of users
+ * found and the last argument the number looked up.
+ */
+
+#if !defined(NO_SDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define HAVE_SDT
+#endif
+#endif
+
+#ifdef HAVE_SDT
+#define PROBE0(name)			DTRACE_PROBE(pam_pwdfile, name)
+#define PROBE1(name, a)			DTRACE_PROBE1(pam_pwdfile, name, a)
+#define PROBE2(name, a, b)		DTRACE_PROBE2(pam_pwdfile, name, a, b)
+#define PROBE3(name, a, b, c)		DTRACE_PROBE3(pam_pwdfile, name, a, b, c)
+#else
+#define PROBE0(name)			do { } while (0)
+#define PROBE1(name, a)			do { (void) (a); } while (0)
+#define PROBE2(name, a, b)		do { (void) (a); (void) (b); } while (0)
+#define PROBE3(name, a, b, c)		do { (void) (a); (void) (b); (void) (c); } while (0)
+#endif
+
+#endif				/* PROBES_H */
@@ -0,0 +1,1615 @@
+/*
+ * libpwdfile: look users up in a password file and check their passwords,
+ * the part of pam_pwdfile that doesn't need PAM, see pwdfile.h.
+ *
+ * This file may be distributed under the same terms as pam_pwdfile.c.
+ */
+
+#define _GNU_SOURCE
+
+#include <syslog.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "pwdfile.h"
+#include "options.h"
+#include "md5.h"
+#include "cryptctx.h"
+#include "pwdtable.h"
+#include "pwdscan.h"
+#include "authcache.h"
+#include "scheme.h"
+#include "probes.h"
+#include "stats.h"
+#include "grace.h"
+#include "failtrack.h"
+#include "admit.h"
+#include "batch.h"
+
+/* index_lookup without a current index */
+#define NO_INDEX -1
+
+/* how long flock waits without flock_timeout, as long as it used to */
+#define FLOCK_TIMEOUT_DEFAULT	75000	/* ms */
+#define FLOCK_MAX_PAUSE		100	/* ms */
+/* reads of a file that keeps changing with the snapshot option */
+#define SNAPSHOT_TRIES		6
+/* how old the last change must be to trust that a writer is done */
+#define SNAPSHOT_SETTLE		10	/* ms */
+/* failures of a user or host before failtrack refuses to check passwords */
+#define FAIL_THRESHOLD_DEFAULT	10
+#define FAIL_WINDOW_DEFAULT	60	/* s */
+/* what crypt_limit allows, in MiB, and how long a check waits for it */
+#define CRYPT_LIMIT_DEFAULT	1024
+#define CRYPT_WAIT_DEFAULT	5000	/* ms */
+/* words in PWDFILE_PRELOAD */
+#define PRELOAD_ARGS_MAX	32
+
+static void pwdfile_log(const struct pwdfile_options *opts, int priority, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static void pwdfile_log(const struct pwdfile_options *opts, int priority, const char *fmt, ...) {
+    va_list ap;
+    
+    va_start(ap, fmt);
+    if (opts->log)
+	opts->log(opts->log_arg, priority, fmt, ap);
+    else
+	vsyslog(LOG_AUTHPRIV | priority, fmt, ap);
+    va_end(ap);
+}
+
+/*
+ * parsed password files, kept across calls with the cache option
+ * Readers use table without locking, inside a grace period, it is only
+ * ever replaced as a whole. Entries are never removed from the list.
+ */
+struct pwdfile_cache {
+    struct pwdfile_cache *next;
+    char *filename;
+    struct pwdtable *table;
+    pthread_mutex_t rebuild_lock;
+    /* with the watch option a thread rebuilds table on changes, readers don't stat */
+    int watching;
+    int watch_fd;
+    struct pwdfile_options watch_opts;
+    /* with the sorted option, whether the version of the file in sorted_st is, under rebuild_lock */
+    int sorted_checked;
+    int sorted;
+    struct stat sorted_st;
+};
+
+static struct pwdfile_cache *caches;
+static pthread_mutex_t caches_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void pause_ms(unsigned ms) {
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+	;
+}
+
+/* get a LOCK_SH or LOCK_EX lock within timeout ms, polling with pauses growing from 1ms */
+static int lock_fd(int fd, int operation, unsigned timeout) {
+    uint64_t deadline = now_ms() + timeout, now;
+    unsigned delay = 1;
+    
+    for (;;) {
+	if (flock(fd, operation | LOCK_NB) != -1)
+	    return 0;
+	if (errno != EWOULDBLOCK)
+	    return -1;
+	if ((now = now_ms()) >= deadline)
+	    return -1;
+	pause_ms(delay < deadline - now ? delay : deadline - now);
+	if ((delay *= 2) > FLOCK_MAX_PAUSE)
+	    delay = FLOCK_MAX_PAUSE;
+    }
+}
+
+/*
+ * With the snapshot option a read is repeated when pwdfile changed while
+ * it was read, instead of locking out writers: size, times and identity
+ * have to be the same before and after. A change in the same clock tick
+ * as the last one would not show in the times, and a writer may not be
+ * done yet, so a file changed within SNAPSHOT_SETTLE ms of now isn't
+ * trusted either. An mtime further in the future, from a skewed clock or
+ * rsync -t, is as settled as an old one, else the file would never be.
+ */
+struct snapshot {
+    struct stat st;
+    struct timespec now;
+};
+
+static int snapshot_begin(int fd, struct snapshot *snap) {
+    clock_gettime(CLOCK_REALTIME, &snap->now);
+    return fstat(fd, &snap->st);
+}
+
+/* whether t is more than SNAPSHOT_SETTLE ms before or after now */
+static int settled(const struct timespec *t, const struct timespec *now) {
+    int64_t ns = (int64_t) (t->tv_sec - now->tv_sec) * 1000000000 + (t->tv_nsec - now->tv_nsec);
+    
+    return ns < -SNAPSHOT_SETTLE * 1000000LL || ns > SNAPSHOT_SETTLE * 1000000LL;
+}
+
+static int snapshot_valid(int fd, const struct snapshot *snap) {
+    const struct stat *a = &snap->st;
+    struct stat b;
+    
+    if (fstat(fd, &b) == -1)
+	return 0;
+    return a->st_dev == b.st_dev && a->st_ino == b.st_ino && a->st_size == b.st_size
+	&& a->st_mtim.tv_sec == b.st_mtim.tv_sec && a->st_mtim.tv_nsec == b.st_mtim.tv_nsec
+	&& a->st_ctim.tv_sec == b.st_ctim.tv_sec && a->st_ctim.tv_nsec == b.st_ctim.tv_nsec
+	&& settled(&a->st_mtim, &snap->now);
+}
+
+/* whether to read again, after a pause */
+static int snapshot_retry(const struct pwdfile_options *opts, FILE *pwdfile, const struct snapshot *snap,
+			  int *tries) {
+    if (!opts->use_snapshot || snapshot_valid(fileno(pwdfile), snap))
+	return 0;
+    if (++*tries == SNAPSHOT_TRIES) {
+	pwdfile_log(opts, LOG_ALERT, "password file %s kept changing while reading it", opts->pwdfilename);
+	errno = EAGAIN;
+	return -1;
+    }
+    if (opts->debug) pwdfile_log(opts, LOG_DEBUG, "password file %s changed while reading it", opts->pwdfilename);
+    pause_ms(1 << (*tries - 1));
+    rewind(pwdfile);
+    return 1;
+}
+
+static FILE *open_pwdfile(const struct pwdfile_options *opts) {
+    char const * pwdfilename = opts->pwdfilename;
+    FILE *pwdfile;
+    
+    PROBE1(open__start, pwdfilename);
+    if (!(pwdfile = fopen(pwdfilename, "r"))) {
+	PROBE2(open__done, pwdfilename, errno);
+	pwdfile_log(opts, LOG_ALERT, "couldn't open password file %s", pwdfilename);
+	return NULL;
+    }
+    PROBE2(open__done, pwdfilename, 0);
+    
+    if (opts->use_flock) {
+	uint64_t start = opts->stats ? stats_now() : 0;
+	int locked;
+	
+	PROBE1(lock__start, pwdfilename);
+	locked = lock_fd(fileno(pwdfile), LOCK_SH, opts->flock_timeout ? opts->flock_timeout : FLOCK_TIMEOUT_DEFAULT);
+	PROBE2(lock__done, pwdfilename, locked);
+	if (opts->stats) {
+	    stats_add(&opts->stats->lock_waits, 1);
+	    stats_add(&opts->stats->lock_wait_ns, stats_now() - start);
+	}
+	if (locked == -1) {
+	    pwdfile_log(opts, LOG_ALERT, "couldn't lock password file %s: %m", pwdfilename);
+	    fclose(pwdfile);
+	    return NULL;
+	}
+    }
+    return pwdfile;
+}
+
+/* find the line of user name by reading through the whole file */
+static int scan_lookup(const struct pwdfile_options *opts, const char *name, char **line) {
+    FILE *pwdfile;
+    size_t namelen = strlen(name);
+    char * linebuf = NULL;
+    size_t linebuflen;
+    long lines;
+    struct snapshot snap;
+    int found, tries = 0, retry;
+    
+    if (!(pwdfile = open_pwdfile(opts)))
+	return PWDFILE_UNAVAIL;
+    
+    do {
+	if (opts->use_snapshot)
+	    snapshot_begin(fileno(pwdfile), &snap);
+	PROBE1(lookup__start, "scan");
+	found = 0;
+	lines = 0;
+	while (getline(&linebuf, &linebuflen, pwdfile) > 0) {
+	    ++lines;
+	    /* first field: username */
+	    if (!strncmp(linebuf, name, namelen) && linebuf[namelen] == ':') {
+		found = 1;
+		break;
+	    }
+	}
+	PROBE3(lookup__done, "scan", found, lines);
+    } while ((retry = snapshot_retry(opts, pwdfile, &snap, &tries)) == 1);
+    fclose(pwdfile);
+    
+    if (retry == -1 || !found) {
+	free(linebuf);
+	linebuf = NULL;
+    }
+    *line = linebuf;
+    return retry == -1 ? PWDFILE_UNAVAIL : PWDFILE_OK;
+}
+
+static struct pwdfile_cache *find_cache(const char *pwdfilename);
+
+/* whether map, the file as of st, is sorted by username; checked once for each version of the file */
+static int map_sorted(const struct pwdfile_options *opts, const char *map, const struct stat *st) {
+    struct pwdfile_cache *cache;
+    const struct stat *last;
+    int sorted;
+    
+    if (!(cache = find_cache(opts->pwdfilename)))
+	return pwdscan_sorted(map, st->st_size);
+    
+    pthread_mutex_lock(&cache->rebuild_lock);
+    last = &cache->sorted_st;
+    if (!cache->sorted_checked || last->st_dev != st->st_dev || last->st_ino != st->st_ino
+	|| last->st_size != st->st_size || last->st_mtim.tv_sec != st->st_mtim.tv_sec
+	|| last->st_mtim.tv_nsec != st->st_mtim.tv_nsec) {
+	cache->sorted_st = *st;
+	cache->sorted_checked = 1;
+	if (!(cache->sorted = pwdscan_sorted(map, st->st_size)))
+	    pwdfile_log(opts, LOG_WARNING, "password file %s isn't sorted by username, searching all of it",
+			opts->pwdfilename);
+    }
+    sorted = cache->sorted;
+    pthread_mutex_unlock(&cache->rebuild_lock);
+    return sorted;
+}
+
+/* find the line of user name in a read-only mapping of the file, only copy that line */
+static int mmap_lookup(const struct pwdfile_options *opts, const char *name, char **line) {
+    FILE *pwdfile;
+    struct snapshot snap;
+    struct stat *st = &snap.st;
+    void *map;
+    const char *found;
+    size_t linelen;
+    int tries = 0, retry, sorted;
+    
+    if (!(pwdfile = open_pwdfile(opts)))
+	return PWDFILE_UNAVAIL;
+    
+    for (;;) {
+	*line = NULL;
+	if (snapshot_begin(fileno(pwdfile), &snap) == -1 || !st->st_size)
+	    goto next;
+	if ((map = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fileno(pwdfile), 0)) == MAP_FAILED) {
+	    pwdfile_log(opts, LOG_ALERT, "couldn't map password file %s: %m", opts->pwdfilename);
+	    fclose(pwdfile);
+	    return PWDFILE_UNAVAIL;
+	}
+	sorted = opts->use_sorted && map_sorted(opts, map, st);
+	(void) madvise(map, st->st_size, sorted ? MADV_RANDOM : MADV_SEQUENTIAL);
+	
+	PROBE1(lookup__start, sorted ? "sorted" : "mmap");
+	if (sorted)
+	    found = pwdscan_bsearch(map, st->st_size, name, &linelen);
+	else
+	    found = pwdscan_find(map, st->st_size, name, &linelen);
+	PROBE3(lookup__done, sorted ? "sorted" : "mmap", found != NULL,
+	       found ? (long) (found - (char *) map) : (long) st->st_size);
+	if (found) {
+	    if (!(*line = malloc(linelen + 1))) {
+		munmap(map, st->st_size);
+		fclose(pwdfile);
+		return PWDFILE_ERROR;
+	    }
+	    memcpy(*line, found, linelen);
+	    (*line)[linelen] = '\0';
+	}
+	munmap(map, st->st_size);
+	next:
+	if ((retry = snapshot_retry(opts, pwdfile, &snap, &tries)) != 1)
+	    break;
+	free(*line);
+    }
+    fclose(pwdfile);
+    
+    if (retry == -1) {
+	free(*line);
+	*line = NULL;
+	return PWDFILE_UNAVAIL;
+    }
+    return PWDFILE_OK;
+}
+
+/*
+ * an index or shared table is trusted with the hashes of every user, so
+ * only one that is a regular file of this user or of the owner of
+ * pwdfile, as of st, and that nobody else may write is mapped
+ */
+static const struct pwdtable *map_table(const struct pwdfile_options *opts, const char *path,
+					const struct stat *st) {
+    const struct pwdtable *table;
+    struct stat table_st;
+    int fd;
+    
+    if ((fd = open(path, O_RDONLY | O_NOFOLLOW)) == -1) {
+	if (errno == ELOOP)
+	    pwdfile_log(opts, LOG_ERR, "not using index %s, it is a symbolic link", path);
+	else if (opts->debug)
+	    pwdfile_log(opts, LOG_DEBUG, "couldn't open index %s: %m", path);
+	return NULL;
+    }
+    if (fstat(fd, &table_st) == -1) {
+	pwdfile_log(opts, LOG_ERR, "couldn't stat index %s: %m", path);
+	close(fd);
+	return NULL;
+    }
+    if (!S_ISREG(table_st.st_mode) || table_st.st_mode & (S_IWGRP | S_IWOTH)
+	|| (table_st.st_uid != geteuid() && table_st.st_uid != st->st_uid)) {
+	pwdfile_log(opts, LOG_ERR, "not using index %s, others than the owner of %s could have written it",
+		    path, opts->pwdfilename);
+	close(fd);
+	return NULL;
+    }
+    table = pwdtable_map(fd);
+    close(fd);
+    if (!table)
+	pwdfile_log(opts, LOG_ERR, "invalid index %s: %m", path);
+    return table;
+}
+
+/* the index if it matches pwdfile, else NULL and NO_INDEX or PWDFILE_UNAVAIL in *retval */
+static const struct pwdtable *map_index(const struct pwdfile_options *opts, int *retval) {
+    char const * pwdfilename = opts->pwdfilename;
+    char const * indexname = opts->indexname;
+    const struct pwdtable *table;
+    struct stat st;
+    
+    *retval = NO_INDEX;
+    if (stat(pwdfilename, &st) == -1) {
+	pwdfile_log(opts, LOG_ALERT, "couldn't stat password file %s", pwdfilename);
+	*retval = PWDFILE_UNAVAIL;
+	return NULL;
+    }
+    if (!(table = map_table(opts, indexname, &st)))
+	return NULL;
+    if (pwdtable_matches(table, &st))
+	return table;
+    if (opts->debug) pwdfile_log(opts, LOG_DEBUG, "index %s is stale", indexname);
+    pwdtable_unmap(table);
+    return NULL;
+}
+
+static int index_lookup(const struct pwdfile_options *opts, const char *name, char **line) {
+    const struct pwdtable *table;
+    const char *found;
+    int retval;
+    
+    if (!(table = map_index(opts, &retval)))
+	return retval;
+    *line = NULL;
+    retval = PWDFILE_OK;
+    PROBE1(lookup__start, "index");
+    found = pwdtable_lookup(table, name);
+    PROBE3(lookup__done, "index", found != NULL, 0);
+    if (found && !(*line = strdup(found)))
+	retval = PWDFILE_ERROR;
+    pwdtable_unmap(table);
+    return retval;
+}
+
+static struct pwdtable *load_table(const struct pwdfile_options *opts);
+
+/*
+ * with shm_table: the table of pwdfile published in a shared memory file
+ * by the first process that saw the current pwdfile, mapped read-only;
+ * or if there was none yet, one parsed in *built after publishing it
+ */
+static const struct pwdtable *shm_table(const struct pwdfile_options *opts, struct pwdtable **built) {
+    struct pwdfile_options shm_opts = *opts;
+    const struct pwdtable *table;
+    struct stat st;
+    int retval;
+    
+    *built = NULL;
+    shm_opts.indexname = opts->shm_tablename;
+    if ((table = map_index(&shm_opts, &retval)))
+	return table;
+    if (retval != NO_INDEX || !(*built = load_table(opts)))
+	return NULL;
+    /* processes racing here publish the same table, the last rename wins */
+    if (stat(opts->pwdfilename, &st) == -1 || pwdtable_write(*built, opts->shm_tablename, &st) == -1)
+	pwdfile_log(opts, LOG_WARNING, "couldn't publish %s: %m", opts->shm_tablename);
+    else if (opts->debug)
+	pwdfile_log(opts, LOG_DEBUG, "published %s", opts->shm_tablename);
+    return NULL;
+}
+
+static int shm_lookup(const struct pwdfile_options *opts, const char *name, char **line) {
+    const struct pwdtable *table;
+    struct pwdtable *built;
+    const char *found;
+    int retval = PWDFILE_OK;
+    
+    if (!(table = shm_table(opts, &built)) && !built)
+	return PWDFILE_UNAVAIL;
+    *line = NULL;
+    PROBE1(lookup__start, "shm");
+    found = pwdtable_lookup(table ? table : built, name);
+    PROBE3(lookup__done, "shm", found != NULL, 0);
+    if (found && !(*line = strdup(found)))
+	retval = PWDFILE_ERROR;
+    if (table)
+	pwdtable_unmap(table);
+    free(built);
+    return retval;
+}
+
+static struct pwdtable *load_table(const struct pwdfile_options *opts) {
+    struct pwdtable *table;
+    struct snapshot snap;
+    FILE *pwdfile;
+    int tries = 0, retry;
+    
+    if (!(pwdfile = open_pwdfile(opts)))
+	return NULL;
+    for (;;) {
+	if (opts->use_snapshot)
+	    snapshot_begin(fileno(pwdfile), &snap);
+	if (!(table = pwdtable_build(fileno(pwdfile))))
+	    break;
+	if ((retry = snapshot_retry(opts, pwdfile, &snap, &tries)) != 1)
+	    break;
+	free(table);
+    }
+    fclose(pwdfile);
+    if (table && retry == -1) {
+	free(table);
+	return NULL;
+    }
+    if (!table) {
+	pwdfile_log(opts, LOG_ERR, "couldn't parse password file %s: %m", opts->pwdfilename);
+	return NULL;
+    }
+    if (opts->debug) pwdfile_log(opts, LOG_DEBUG, "cached %u entries of %s", table->nentries, opts->pwdfilename);
+    if (opts->stats)
+	stats_add(&opts->stats->reloads, 1);
+    return table;
+}
+
+/* publish a new table and free the old one once no reader can use it any more */
+static void replace_table(struct pwdfile_cache *cache, struct pwdtable *table) {
+    struct pwdtable *old = __atomic_exchange_n(&cache->table, table, __ATOMIC_SEQ_CST);
+    
+    if (old) {
+	grace_wait();
+	free(old);
+    }
+}
+
+/* rebuild the table whenever pwdfile is written or something is moved over it */
+static void *watch_pwdfile(void *arg) {
+    struct pwdfile_cache *cache = arg;
+    const char *base = strrchr(cache->filename, '/') ? strrchr(cache->filename, '/') + 1 : cache->filename;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    
+    for (;;) {
+	const struct inotify_event *event;
+	struct pwdtable *table;
+	struct stat st;
+	ssize_t len = read(cache->watch_fd, buf, sizeof(buf));
+	int changed = 0, gone = 0;
+	char *p;
+	
+	if (len < 0 && errno == EINTR)
+	    continue;
+	if (len <= 0)
+	    break;
+	for (p = buf; p < buf + len; p += sizeof(*event) + event->len) {
+	    event = (const struct inotify_event *) p;
+	    if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+		gone = 1;
+	    if (event->mask & IN_Q_OVERFLOW || (event->len && !strcmp(event->name, base)))
+		changed = 1;
+	}
+	if (gone)
+	    break;
+	if (!changed)
+	    continue;
+	
+	/* on errors readers go back to checking the file themselves and report them */
+	pthread_mutex_lock(&cache->rebuild_lock);
+	/* pwdfile_update of this process patched it already */
+	if (cache->table && stat(cache->filename, &st) == 0 && pwdtable_matches(cache->table, &st)) {
+	    pthread_mutex_unlock(&cache->rebuild_lock);
+	    continue;
+	}
+	if (!(table = load_table(&cache->watch_opts))) {
+	    pthread_mutex_unlock(&cache->rebuild_lock);
+	    break;
+	}
+	replace_table(cache, table);
+	pthread_mutex_unlock(&cache->rebuild_lock);
+    }
+    
+    pthread_mutex_lock(&cache->rebuild_lock);
+    __atomic_store_n(&cache->watching, 0, __ATOMIC_RELEASE);
+    close(cache->watch_fd);
+    pthread_mutex_unlock(&cache->rebuild_lock);
+    return NULL;
+}
+
+/* the watcher threads are gone in a child, make its readers check the file again */
+static void atfork_child(void) {
+    struct pwdfile_cache *cache;
+    
+    grace_reset();
+    for (cache = caches; cache; cache = cache->next) {
+	pthread_mutex_init(&cache->rebuild_lock, NULL);
+	if (cache->watching) {
+	    close(cache->watch_fd);
+	    cache->watching = 0;
+	}
+    }
+}
+
+static void register_atfork(void) {
+    pthread_atfork(NULL, NULL, atfork_child);
+}
+
+/* called with rebuild_lock held */
+static void start_watch(const struct pwdfile_options *opts, struct pwdfile_cache *cache) {
+    char *dir = strdup(cache->filename), *slash;
+    pthread_attr_t attr;
+    pthread_t thread;
+    int fd;
+    
+    if (!dir)
+	return;
+    if ((slash = strrchr(dir, '/')))
+	*(slash == dir ? slash + 1 : slash) = '\0';
+    else
+	strcpy(dir, ".");
+    
+    if ((fd = inotify_init1(IN_CLOEXEC)) == -1
+	|| inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_ATTRIB
+			     | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR) == -1) {
+	pwdfile_log(opts, LOG_ERR, "couldn't watch %s: %m", dir);
+	if (fd != -1)
+	    close(fd);
+	free(dir);
+	return;
+    }
+    free(dir);
+    
+    cache->watch_fd = fd;
+    cache->watch_opts = *opts;
+    cache->watch_opts.pwdfilename = cache->filename;
+    cache->watch_opts.indexname = NULL;
+    cache->watch_opts.log = NULL;
+    pthread_once(&atfork_once, register_atfork);
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, watch_pwdfile, cache)) {
+	pwdfile_log(opts, LOG_ERR, "couldn't start watching %s", cache->filename);
+	close(fd);
+    } else {
+	if (opts->debug) pwdfile_log(opts, LOG_DEBUG, "watching %s", cache->filename);
+	__atomic_store_n(&cache->watching, 1, __ATOMIC_RELEASE);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+static struct pwdfile_cache *find_cache(const char *pwdfilename) {
+    struct pwdfile_cache *cache;
+    
+    for (cache = __atomic_load_n(&caches, __ATOMIC_ACQUIRE); cache; cache = cache->next)
+	if (!strcmp(cache->filename, pwdfilename))
+	    return cache;
+    
+    pthread_mutex_lock(&caches_lock);
+    for (cache = caches; cache; cache = cache->next)
+	if (!strcmp(cache->filename, pwdfilename))
+	    goto out;
+    if (!(cache = calloc(1, sizeof(*cache))) || !(cache->filename = strdup(pwdfilename))) {
+	free(cache);
+	cache = NULL;
+	goto out;
+    }
+    pthread_mutex_init(&cache->rebuild_lock, NULL);
+    cache->next = caches;
+    __atomic_store_n(&caches, cache, __ATOMIC_RELEASE);
+    out:
+    pthread_mutex_unlock(&caches_lock);
+    return cache;
+}
+
+/* make cache->table current, st is pwdfile as seen by the caller */
+static int refresh_cache(const struct pwdfile_options *opts, struct pwdfile_cache *cache,
+			 const struct stat *st) {
+    struct pwdtable *table;
+    int retval = PWDFILE_OK;
+    
+    pthread_mutex_lock(&cache->rebuild_lock);
+    if (opts->use_watch && !cache->watching) {
+	start_watch(opts, cache);
+	/* pwdfile may have changed before the watch was set up */
+	table = NULL;
+    } else
+	table = cache->table;
+    
+    /* another thread may have been faster */
+    if (!table || !pwdtable_matches(table, st)) {
+	if ((table = load_table(opts)))
+	    replace_table(cache, table);
+	else
+	    retval = PWDFILE_UNAVAIL;
+    }
+    pthread_mutex_unlock(&cache->rebuild_lock);
+    return retval;
+}
+
+/* find the line of user name in the parsed copy, reparse if the file has changed */
+static int cache_lookup(const struct pwdfile_options *opts, const char *name, char **line) {
+    char const * pwdfilename = opts->pwdfilename;
+    struct pwdfile_cache *cache;
+    const struct pwdtable *table;
+    struct stat st;
+    const char *found;
+    unsigned token;
+    int watching;
+    int retval = PWDFILE_OK;
+    
+    if (!(cache = find_cache(pwdfilename)))
+	return PWDFILE_ERROR;
+    
+    if (!(watching = __atomic_load_n(&cache->watching, __ATOMIC_ACQUIRE))
+	&& stat(pwdfilename, &st) == -1) {
+	pwdfile_log(opts, LOG_ALERT, "couldn't stat password file %s", pwdfilename);
+	return PWDFILE_UNAVAIL;
+    }
+    
+    token = grace_enter();
+    table = __atomic_load_n(&cache->table, __ATOMIC_SEQ_CST);
+    if (!table || (!watching && !pwdtable_matches(table, &st))) {
+	grace_leave(token);
+	if (watching && stat(pwdfilename, &st) == -1) {
+	    pwdfile_log(opts, LOG_ALERT, "couldn't stat password file %s", pwdfilename);
+	    return PWDFILE_UNAVAIL;
+	}
+	if ((retval = refresh_cache(opts, cache, &st)) != PWDFILE_OK)
+	    return retval;
+	token = grace_enter();
+	table = __atomic_load_n(&cache->table, __ATOMIC_SEQ_CST);
+    }
+    
+    *line = NULL;
+    PROBE1(lookup__start, "cache");
+    found = pwdtable_lookup(table, name);
+    PROBE3(lookup__done, "cache", found != NULL, 0);
+    if (found && !(*line = strdup(found)))
+	retval = PWDFILE_ERROR;
+    grace_leave(token);
+    return retval;
+}
+
+/*
+ * parse pwdfile into the cache now, e.g. in a server that forks its
+ * workers later: they inherit the table copy-on-write and only parse
+ * pwdfile again when it changed since
+ */
+static void preload_cache(const struct pwdfile_options *opts) {
+    struct pwdfile_cache *cache;
+    struct stat st;
+    
+    /* those are looked up elsewhere */
+    if (!opts->pwdfilename || opts->pwdfile_dir || opts->indexname || opts->shm_tablename)
+	return;
+    if (!(cache = find_cache(opts->pwdfilename)) || __atomic_load_n(&cache->table, __ATOMIC_ACQUIRE))
+	return;
+    /* a child must not wait for readers of the parent */
+    pthread_once(&atfork_once, register_atfork);
+    if (stat(opts->pwdfilename, &st) == -1) {
+	pwdfile_log(opts, LOG_ALERT, "couldn't stat password file %s", opts->pwdfilename);
+	return;
+    }
+    if (refresh_cache(opts, cache, &st) == PWDFILE_OK && opts->debug)
+	pwdfile_log(opts, LOG_DEBUG, "preloaded %s", opts->pwdfilename);
+}
+
+/*
+ * PWDFILE_PRELOAD holds module arguments, e.g. "pwdfile=/etc/pwdfile watch",
+ * for servers that load the module before forking but only use it in the
+ * children; pwdfile is preloaded as soon as the module is loaded
+ */
+__attribute__((constructor))
+static void preload_env(void) {
+    const char *env = secure_getenv("PWDFILE_PRELOAD");
+    const char *argv[PRELOAD_ARGS_MAX];
+    struct pwdfile_options opts;
+    char *args, *arg, *save;
+    int argc = 0;
+    
+    /* never freed, the options point into it */
+    if (!env || !(args = strdup(env)))
+	return;
+    argv[argc++] = "preload";
+    for (arg = strtok_r(args, " \t", &save); arg && argc < PRELOAD_ARGS_MAX; arg = strtok_r(NULL, " \t", &save))
+	argv[argc++] = arg;
+    pwdfile_options_init(&opts);
+    pwdfile_options_parse(&opts, argc, argv);
+}
+
+void pwdfile_options_init(struct pwdfile_options *opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->shards = PWDFILE_SHARDS;
+    opts->use_delay = 1;
+    opts->fail_threshold = FAIL_THRESHOLD_DEFAULT;
+    opts->fail_window = FAIL_WINDOW_DEFAULT;
+    opts->crypt_wait = CRYPT_WAIT_DEFAULT;
+}
+
+struct pwdfile_options *pwdfile_options_new(void) {
+    struct pwdfile_options *opts;
+    
+    if ((opts = malloc(sizeof(*opts))))
+	pwdfile_options_init(opts);
+    return opts;
+}
+
+/* what parse attached is shared by the process and stays */
+void pwdfile_options_free(struct pwdfile_options *opts) {
+    free(opts);
+}
+
+void pwdfile_options_set_log(struct pwdfile_options *opts, pwdfile_log_fn *log, void *log_arg) {
+    opts->log = log;
+    opts->log_arg = log_arg;
+}
+
+void pwdfile_options_parse(struct pwdfile_options *opts, int argc, const char **argv) {
+    const char *crypt_limit = NULL;
+    unsigned long crypt_limit_mb = CRYPT_LIMIT_DEFAULT;
+    int i, preload = 0;
+    
+    for (i = 0; i < argc; ++i) {
+	if (!strcmp(argv[i], "pwdfile") && i + 1 < argc)
+	    opts->pwdfilename = argv[++i];
+	else if (!strncmp(argv[i], "pwdfile=", strlen("pwdfile=")))
+	    opts->pwdfilename = argv[i] + strlen("pwdfile=");
+	else if (!strncmp(argv[i], "pwdfile_index=", strlen("pwdfile_index=")))
+	    opts->indexname = argv[i] + strlen("pwdfile_index=");
+	else if (!strncmp(argv[i], "pwdfile_dir=", strlen("pwdfile_dir=")))
+	    opts->pwdfile_dir = argv[i] + strlen("pwdfile_dir=");
+	else if (!strncmp(argv[i], "shards=", strlen("shards="))) {
+	    if (!(opts->shards = strtoul(argv[i] + strlen("shards="), NULL, 10)) || opts->shards > 65536) {
+		pwdfile_log(opts, LOG_ERR, "invalid number of shards %s", argv[i] + strlen("shards="));
+		opts->shards = PWDFILE_SHARDS;
+	    }
+	}
+	else if (!strcmp(argv[i], "flock"))
+	    opts->use_flock = 1;
+	else if (!strcmp(argv[i], "noflock"))
+	    opts->use_flock = 0;
+	else if (!strncmp(argv[i], "flock_timeout=", strlen("flock_timeout="))) {
+	    const char *value = argv[i] + strlen("flock_timeout=");
+	    char *end;
+	    long timeout;
+	    
+	    opts->use_flock = 1;
+	    errno = 0;
+	    timeout = strtol(value, &end, 10);
+	    if (end == value || *end || errno || timeout <= 0 || timeout > INT_MAX) {
+		pwdfile_log(opts, LOG_ERR, "invalid flock timeout %s", value);
+		opts->flock_timeout = 0;
+	    } else
+		opts->flock_timeout = timeout;
+	}
+	else if (!strcmp(argv[i], "snapshot"))
+	    opts->use_snapshot = 1;
+	else if (!strcmp(argv[i], "nodelay"))
+	    opts->use_delay = 0;
+	else if (!strcmp(argv[i], "debug"))
+	    opts->debug = 1;
+	else if (!strcmp(argv[i], "legacy_crypt"))
+	    opts->legacy_crypt = 1;
+	else if (!strcmp(argv[i], "builtin_sha"))
+	    opts->builtin_sha = 1;
+	else if (!strncmp(argv[i], "expire_field=", strlen("expire_field="))) {
+	    opts->expire_field = strtoul(argv[i] + strlen("expire_field="), NULL, 10);
+	    if (opts->expire_field && opts->expire_field < 3) {
+		pwdfile_log(opts, LOG_ERR, "expire_field can't be user name or password");
+		opts->expire_field = 0;
+	    }
+	}
+	else if (!strncmp(argv[i], "rehash=", strlen("rehash="))) {
+	    const char *arg = argv[i] + strlen("rehash="), *colon = strchr(arg, ':');
+	    enum scheme scheme = scheme_named(arg, colon ? (size_t) (colon - arg) : strlen(arg));
+	    
+	    if (scheme == SCHEME_COUNT || !(opts->rehash_prefix = scheme_prefix(scheme)))
+		pwdfile_log(opts, LOG_ERR, "can't rehash passwords to %s", arg);
+	    opts->rehash_cost = colon ? strtoul(colon + 1, NULL, 10) : 0;
+	}
+	else if (!strcmp(argv[i], "cache"))
+	    opts->use_cache = 1;
+	else if (!strcmp(argv[i], "watch"))
+	    opts->use_cache = opts->use_watch = 1;
+	else if (!strcmp(argv[i], "preload"))
+	    opts->use_cache = preload = 1;
+	else if (!strcmp(argv[i], "mmap"))
+	    opts->use_mmap = 1;
+	else if (!strcmp(argv[i], "sorted"))
+	    opts->use_mmap = opts->use_sorted = 1;
+	else if (!strncmp(argv[i], "daemon=", strlen("daemon=")))
+	    opts->daemon_socket = argv[i] + strlen("daemon=");
+	else if (!strncmp(argv[i], "shm_table=", strlen("shm_table=")))
+	    opts->shm_tablename = argv[i] + strlen("shm_table=");
+	else if (!strncmp(argv[i], "authcache=", strlen("authcache=")))
+	    opts->authcache_ttl = strtoul(argv[i] + strlen("authcache="), NULL, 10);
+	else if (!strcmp(argv[i], "authcache_negative"))
+	    opts->authcache_negative = 1;
+	else if (!strncmp(argv[i], "stats=", strlen("stats="))) {
+	    if (!(opts->stats = stats_get(argv[i] + strlen("stats="))))
+		pwdfile_log(opts, LOG_ERR, "couldn't map statistics file %s: %m", argv[i] + strlen("stats="));
+	}
+	else if (!strncmp(argv[i], "failtrack=", strlen("failtrack="))) {
+	    if (!(opts->failtrack = failtrack_get(argv[i] + strlen("failtrack="))))
+		pwdfile_log(opts, LOG_ERR, "couldn't map failure tracking file %s: %m", argv[i] + strlen("failtrack="));
+	}
+	else if (!strncmp(argv[i], "fail_threshold=", strlen("fail_threshold="))) {
+	    if (!(opts->fail_threshold = strtoul(argv[i] + strlen("fail_threshold="), NULL, 10))) {
+		pwdfile_log(opts, LOG_ERR, "invalid failure threshold %s", argv[i] + strlen("fail_threshold="));
+		opts->fail_threshold = FAIL_THRESHOLD_DEFAULT;
+	    }
+	}
+	else if (!strncmp(argv[i], "fail_window=", strlen("fail_window="))) {
+	    if (!(opts->fail_window = strtoul(argv[i] + strlen("fail_window="), NULL, 10))) {
+		pwdfile_log(opts, LOG_ERR, "invalid failure window %s", argv[i] + strlen("fail_window="));
+		opts->fail_window = FAIL_WINDOW_DEFAULT;
+	    }
+	}
+	else if (!strncmp(argv[i], "crypt_limit=", strlen("crypt_limit=")))
+	    crypt_limit = argv[i] + strlen("crypt_limit=");
+	else if (!strncmp(argv[i], "crypt_limit_mb=", strlen("crypt_limit_mb="))) {
+	    crypt_limit_mb = strtoul(argv[i] + strlen("crypt_limit_mb="), NULL, 10);
+	    if (!crypt_limit_mb || crypt_limit_mb > ADMIT_UNITS_MAX) {
+		pwdfile_log(opts, LOG_ERR, "invalid crypt limit %s", argv[i] + strlen("crypt_limit_mb="));
+		crypt_limit_mb = CRYPT_LIMIT_DEFAULT;
+	    }
+	}
+	else if (!strncmp(argv[i], "crypt_wait=", strlen("crypt_wait=")))
+	    opts->crypt_wait = strtoul(argv[i] + strlen("crypt_wait="), NULL, 10);
+    }
+    
+    /* after the loop, crypt_limit_mb may come later */
+    if (crypt_limit) {
+	if (!(opts->admit = admit_get(crypt_limit, crypt_limit_mb)))
+	    pwdfile_log(opts, LOG_ERR, "couldn't get crypt limit semaphore for %s: %m", crypt_limit);
+	else if (admit_units(opts->admit) != crypt_limit_mb && opts->debug)
+	    pwdfile_log(opts, LOG_DEBUG, "crypt limit %s was set up with %u MiB, not %lu",
+			crypt_limit, admit_units(opts->admit), crypt_limit_mb);
+    }
+    if (preload)
+	preload_cache(opts);
+}
+
+/*
+ * with pwdfile_dir, the options for the user's shard and its index, if
+ * there is one; the names are in the returned block, free() it after use
+ */
+static char *shard_options(const struct pwdfile_options *opts, const char *user,
+			   struct pwdfile_options *shard_opts) {
+    unsigned shard = pwdtable_shard(user, strlen(user), opts->shards);
+    size_t len = strlen(opts->pwdfile_dir) + sizeof("/ffff");
+    size_t shm_len = opts->shm_tablename ? strlen(opts->shm_tablename) + sizeof(".ffff") : 0;
+    char *shardname;
+    int n;
+    
+    if (!(shardname = malloc(2 * len + strlen(".idx") + shm_len)))
+	return NULL;
+    n = sprintf(shardname, "%s/%04x", opts->pwdfile_dir, shard);
+    memcpy(shardname + len, shardname, n);
+    strcpy(shardname + len + n, ".idx");
+    if (opts->debug) pwdfile_log(opts, LOG_DEBUG, "user is in shard %s", shardname);
+    *shard_opts = *opts;
+    shard_opts->pwdfilename = shardname;
+    shard_opts->indexname = shardname + len;
+    /* each shard is published on its own, in <shm_table>.<shard> */
+    if (opts->shm_tablename) {
+	shard_opts->shm_tablename = shardname + 2 * len + strlen(".idx");
+	sprintf(shardname + 2 * len + strlen(".idx"), "%s.%04x", opts->shm_tablename, shard);
+    }
+    /* one watcher thread per shard would be too many */
+    shard_opts->use_watch = 0;
+    return shardname;
+}
+
+/*
+ * a username with a separator would match across it in the scan, with
+ * the line of the name before it, but not in a table; it is nobody's
+ */
+static int user_valid(const struct pwdfile_options *opts, const char *user) {
+    if (!strpbrk(user, ":\n"))
+	return 1;
+    if (opts->debug) pwdfile_log(opts, LOG_DEBUG, "username with ':' or newline, not in password database");
+    return 0;
+}
+
+enum pwdfile_result pwdfile_lookup(const struct pwdfile_options *opts, const char *user, char **line) {
+    uint64_t start = 0;
+    int retval;
+    struct pwdfile_options shard_opts;
+    char *shardname = NULL;
+    
+    *line = NULL;
+    if (!user_valid(opts, user))
+	return PWDFILE_UNKNOWN;
+    if (opts->pwdfile_dir) {
+	if (!(shardname = shard_options(opts, user, &shard_opts)))
+	    return PWDFILE_ERROR;
+	opts = &shard_opts;
+    }
+    
+    /* we require the pwdfile switch and argument to be present, else we don't work */
+    if (!opts->pwdfilename) {
+	pwdfile_log(opts, LOG_ERR, "password file name not specified");
+	return PWDFILE_UNAVAIL;
+    }
+    
+    /* get the crypted password corresponding to this user out of pwdfile */
+    if (opts->stats)
+	start = stats_now();
+    retval = NO_INDEX;
+    if (opts->indexname)
+	retval = index_lookup(opts, user, line);
+    if (retval == NO_INDEX) {
+	if (opts->shm_tablename)
+	    retval = shm_lookup(opts, user, line);
+	else if (opts->use_cache)
+	    retval = cache_lookup(opts, user, line);
+	else if (opts->use_mmap)
+	    retval = mmap_lookup(opts, user, line);
+	else
+	    retval = scan_lookup(opts, user, line);
+    }
+    if (opts->stats)
+	stats_time(opts->stats->lookup_us, stats_now() - start);
+    free(shardname);
+    if (retval != PWDFILE_OK)
+	return retval;
+    
+    if (!*line) {
+	if (opts->debug) pwdfile_log(opts, LOG_ERR, "user not found in password database");
+	return PWDFILE_UNKNOWN;
+    }
+    return PWDFILE_OK;
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+    ssize_t n;
+    
+    for (; len; buf += n, len -= n)
+	if ((n = write(fd, buf, len)) == -1)
+	    return -1;
+    return 0;
+}
+
+/*
+ * after pwdfile_update: an index or shm_table that was current is patched
+ * for the new pwdfile instead of built again, until replaced lines take up
+ * half of it; any other one is built from it
+ */
+static void update_index(const struct pwdfile_options *opts, const char *indexname, const char *user,
+			 const char *line, const struct stat *old, const struct stat *updated, int fd) {
+    const struct pwdtable *index = map_table(opts, indexname, old);
+    struct pwdtable *table = NULL;
+    
+    if (index && pwdtable_matches(index, old))
+	table = pwdtable_patch(index, user, line, updated);
+    if (!table) {
+	if (opts->debug) pwdfile_log(opts, LOG_DEBUG, "building index %s again", indexname);
+	if (lseek(fd, 0, SEEK_SET) != -1)
+	    table = pwdtable_build(fd);
+    }
+    if (!table || pwdtable_write(table, indexname, updated) == -1)
+	pwdfile_log(opts, LOG_WARNING, "couldn't update index %s: %m", indexname);
+    if (index)
+	pwdtable_unmap(index);
+    free(table);
+}
+
+/*
+ * after pwdfile_update: the copy of this process, if it was current, so
+ * that it isn't read again; unless the patches left too much of it unused
+ */
+static void update_cache(const struct pwdfile_options *opts, const char *user, const char *line,
+			 const struct stat *old, const struct stat *updated) {
+    struct pwdfile_cache *cache;
+    struct pwdtable *table = NULL;
+    
+    if (!(cache = find_cache(opts->pwdfilename)))
+	return;
+    pthread_mutex_lock(&cache->rebuild_lock);
+    if (cache->table && pwdtable_matches(cache->table, old)
+	&& (table = pwdtable_patch(cache->table, user, line, updated)))
+	replace_table(cache, table);
+    pthread_mutex_unlock(&cache->rebuild_lock);
+}
+
+enum pwdfile_result pwdfile_update(const struct pwdfile_options *opts, const char *user,
+				   const char *old, const char *crypted) {
+    struct pwdfile_options shard_opts;
+    char *shardname = NULL, *data = NULL, *tmpname = NULL, *newline = NULL, *line, *next, *field;
+    size_t ulen = strlen(user), len = 0, flen;
+    struct stat st, current, updated;
+    enum pwdfile_result retval = PWDFILE_UNAVAIL;
+    int fd = -1, tmp = -1;
+    ssize_t n = 0;
+    
+    if (strpbrk(crypted, ":\n")) {
+	pwdfile_log(opts, LOG_ERR, "invalid crypt string for user %s", user);
+	return PWDFILE_ERROR;
+    }
+    if (!user_valid(opts, user))
+	return PWDFILE_UNKNOWN;
+    if (opts->pwdfile_dir) {
+	if (!(shardname = shard_options(opts, user, &shard_opts)))
+	    return PWDFILE_ERROR;
+	opts = &shard_opts;
+    }
+    if (!opts->pwdfilename) {
+	pwdfile_log(opts, LOG_ERR, "password file name not specified");
+	goto out;
+    }
+    
+    /* a writer that waited for the lock may find pwdfile replaced by the one before it */
+    for (;;) {
+	if ((fd = open(opts->pwdfilename, O_RDONLY | O_CLOEXEC)) == -1) {
+	    pwdfile_log(opts, LOG_ALERT, "couldn't open password file %s", opts->pwdfilename);
+	    goto out;
+	}
+	if (lock_fd(fd, LOCK_EX, opts->flock_timeout ? opts->flock_timeout : FLOCK_TIMEOUT_DEFAULT) == -1) {
+	    pwdfile_log(opts, LOG_ALERT, "couldn't lock password file %s: %m", opts->pwdfilename);
+	    goto out;
+	}
+	if (fstat(fd, &st) == -1 || stat(opts->pwdfilename, &current) == -1) {
+	    pwdfile_log(opts, LOG_ALERT, "couldn't stat password file %s", opts->pwdfilename);
+	    goto out;
+	}
+	if (st.st_dev == current.st_dev && st.st_ino == current.st_ino)
+	    break;
+	close(fd);
+    }
+    
+    retval = PWDFILE_ERROR;
+    if (!(data = malloc(st.st_size + 1)))
+	goto out;
+    while (len < (size_t) st.st_size && (n = read(fd, data + len, st.st_size - len)) > 0)
+	len += n;
+    if (n == -1) {
+	pwdfile_log(opts, LOG_ALERT, "couldn't read password file %s: %m", opts->pwdfilename);
+	goto out;
+    }
+    data[len] = '\0';
+    
+    /* the first line of user, as in the lookup */
+    for (line = data; line < data + len; line = next + 1) {
+	if (!(next = memchr(line, '\n', data + len - line)))
+	    next = data + len;
+	if ((size_t) (next - line) > ulen && !strncmp(line, user, ulen) && line[ulen] == ':')
+	    break;
+    }
+    if (line >= data + len) {
+	retval = PWDFILE_UNKNOWN;
+	goto out;
+    }
+    flen = pwdfile_crypted(line, (const char **) &field);
+    if (old && (strlen(old) != flen || strncmp(field, old, flen))) {
+	if (opts->debug) pwdfile_log(opts, LOG_DEBUG, "password of user %s changed meanwhile", user);
+	retval = PWDFILE_WRONG;
+	goto out;
+    }
+    
+    if (asprintf(&newline, "%.*s%s%.*s", (int) (field - line), line, crypted,
+		 (int) (next - field - flen), field + flen) == -1) {
+	newline = NULL;
+	goto out;
+    }
+    if (asprintf(&tmpname, "%s.XXXXXX", opts->pwdfilename) == -1) {
+	tmpname = NULL;
+	goto out;
+    }
+    if ((tmp = mkostemp(tmpname, O_CLOEXEC)) == -1) {
+	pwdfile_log(opts, LOG_ALERT, "couldn't create %s: %m", tmpname);
+	goto out;
+    }
+    /* keep owner and mode; without privileges the owner is the caller, that still works for the caller */
+    if (fchown(tmp, st.st_uid, st.st_gid) == -1 && opts->debug)
+	pwdfile_log(opts, LOG_DEBUG, "couldn't keep owner of %s: %m", opts->pwdfilename);
+    if (fchmod(tmp, st.st_mode & 07777) == -1 || write_all(tmp, data, line - data) == -1
+	|| write_all(tmp, newline, strlen(newline)) == -1 || write_all(tmp, next, data + len - next) == -1
+	|| fsync(tmp) == -1 || fstat(tmp, &updated) == -1 || rename(tmpname, opts->pwdfilename) == -1) {
+	pwdfile_log(opts, LOG_ALERT, "couldn't replace password file %s: %m", opts->pwdfilename);
+	unlink(tmpname);
+	goto out;
+    }
+    retval = PWDFILE_OK;
+    
+    if (opts->indexname)
+	update_index(opts, opts->indexname, user, newline, &st, &updated, tmp);
+    if (opts->shm_tablename)
+	update_index(opts, opts->shm_tablename, user, newline, &st, &updated, tmp);
+    if (opts->use_cache)
+	update_cache(opts, user, newline, &st, &updated);
+    
+out:
+    if (tmp != -1)
+	close(tmp);
+    /* unlocks */
+    if (fd != -1)
+	close(fd);
+    free(tmpname);
+    free(newline);
+    free(data);
+    free(shardname);
+    return retval;
+}
+
+enum pwdfile_result pwdfile_change(const struct pwdfile_options *opts, const char *user,
+				   const char *old, const char *password) {
+    const char *prefix = opts->rehash_prefix, *crypted;
+    unsigned long cost = opts->rehash_cost;
+    struct cryptctx *ctx;
+    enum pwdfile_result retval;
+    
+    /* without rehash= the scheme stays, or becomes the default of crypt_gensalt */
+    if (!prefix) {
+	prefix = old ? scheme_prefix(scheme_of(old)) : NULL;
+	cost = 0;
+    }
+    if (!(ctx = cryptctx_get()))
+	return PWDFILE_ERROR;
+    if (!(crypted = cryptctx_hash(ctx, password, prefix, cost))) {
+	pwdfile_log(opts, LOG_ERR, "couldn't hash new password of user %s: %m", user);
+	cryptctx_wipe(ctx);
+	return PWDFILE_ERROR;
+    }
+    if ((retval = pwdfile_update(opts, user, old, crypted)) == PWDFILE_OK)
+	pwdfile_log(opts, LOG_NOTICE, "changed password of user %s", user);
+    cryptctx_wipe(ctx);
+    return retval;
+}
+
+size_t pwdfile_crypted(const char *line, const char **crypted) {
+    /* second field: password (until next colon or newline) */
+    *crypted = strchr(line, ':') + 1;
+    return strcspn(*crypted, ":\n");
+}
+
+size_t pwdfile_field(const char *line, unsigned n, const char **field) {
+    const char *end = line + strcspn(line, "\n");
+    
+    for (*field = line; n > 1; n--) {
+	if (!(*field = memchr(*field, ':', end - *field))) {
+	    *field = NULL;
+	    return 0;
+	}
+	++*field;
+    }
+    return strcspn(*field, ":\n");
+}
+
+/* like the expire field of shadow(5): days since 1970-01-01, empty for never */
+enum pwdfile_account pwdfile_account(const struct pwdfile_options *opts, const char *line) {
+    const char *field;
+    char *end;
+    long days;
+    size_t len;
+    
+    pwdfile_crypted(line, &field);
+    if (*field == '!') {
+	pwdfile_log(opts, LOG_NOTICE, "account %.*s is locked", (int) strcspn(line, ":"), line);
+	return PWDFILE_ACCOUNT_LOCKED;
+    }
+    if (!opts->expire_field || !(len = pwdfile_field(line, opts->expire_field, &field)))
+	return PWDFILE_ACCOUNT_OK;
+    
+    days = strtol(field, &end, 10);
+    /* a field that can't be read fails closed */
+    if (end != field + len || days < 0) {
+	pwdfile_log(opts, LOG_ERR, "invalid expiry date %.*s of account %.*s", (int) len, field,
+		    (int) strcspn(line, ":"), line);
+	return PWDFILE_ACCOUNT_EXPIRED;
+    }
+    if (time(NULL) / 86400 >= days) {
+	pwdfile_log(opts, LOG_NOTICE, "account %.*s has expired", (int) strcspn(line, ":"), line);
+	return PWDFILE_ACCOUNT_EXPIRED;
+    }
+    if (opts->debug) pwdfile_log(opts, LOG_DEBUG, "account expires in %ld days", days - time(NULL) / 86400);
+    return PWDFILE_ACCOUNT_OK;
+}
+
+/* move the password of user to the rehash= scheme; if that fails, the next login tries again */
+static void rehash(const struct pwdfile_options *opts, struct cryptctx *ctx, const char *user,
+		   const char *stored, const char *password) {
+    const char *crypted;
+    
+    PROBE1(rehash__start, user);
+    if (!(crypted = cryptctx_hash(ctx, password, opts->rehash_prefix, opts->rehash_cost))) {
+	PROBE1(rehash__done, 0);
+	pwdfile_log(opts, LOG_ERR, "couldn't rehash password of user %s: %m", user);
+	return;
+    }
+    if (pwdfile_update(opts, user, stored, crypted) == PWDFILE_OK) {
+	PROBE1(rehash__done, 1);
+	pwdfile_log(opts, LOG_NOTICE, "rehashed password of user %s from %s to %s", user,
+		    scheme_names[scheme_of(stored)], scheme_names[scheme_of(crypted)]);
+    } else
+	PROBE1(rehash__done, 0);
+}
+
+/* the units of crypt_limit a check of crypted takes: the MiB it needs, at least 1 */
+static unsigned crypt_units(const struct pwdfile_options *opts, const char *crypted) {
+    unsigned long long mb = (scheme_memory(crypted) + (1 << 20) - 1) >> 20;
+    
+    if (!mb)
+	return 1;
+    /* more than there is runs alone */
+    return mb < admit_units(opts->admit) ? mb : admit_units(opts->admit);
+}
+
+enum pwdfile_result pwdfile_check(const struct pwdfile_options *opts, const char *user,
+				  const char *line, const char *password) {
+    const char *field;
+    size_t len;
+    char * stored_crypted_password;
+    char const * crypted_password;
+    enum scheme scheme;
+    enum pwdfile_result retval;
+    uint64_t start = 0;
+    char legacy_crypted[MD5_CRYPT_OUTPUT_SIZE];
+    struct cryptctx *ctx;
+    unsigned units = 0;
+    
+    len = pwdfile_crypted(line, &field);
+    if (!(stored_crypted_password = strndup(field, len)))
+	return PWDFILE_ERROR;
+    
+    if (!*stored_crypted_password) {
+	if (opts->debug) pwdfile_log(opts, LOG_DEBUG, "user has empty password field");
+	free(stored_crypted_password);
+	return *password ? PWDFILE_WRONG : PWDFILE_OK;
+    }
+    
+    if (opts->debug) pwdfile_log(opts, LOG_DEBUG, "got crypted password == '%s'", stored_crypted_password);
+    
+    scheme = scheme_of(stored_crypted_password);
+    if (opts->stats)
+	stats_add(&opts->stats->schemes[scheme], 1);
+    
+    if (opts->authcache_ttl) {
+	enum authcache_result cached = authcache_check(user, stored_crypted_password, password);
+	PROBE1(authcache__done, (int) cached);
+	
+	if (opts->debug) {
+	    unsigned long hits, misses;
+	    authcache_counters(&hits, &misses);
+	    pwdfile_log(opts, LOG_DEBUG, "authcache %s (%lu hits, %lu misses)",
+			cached == AUTHCACHE_MISS ? "miss" : "hit", hits, misses);
+	}
+	if (cached == AUTHCACHE_GOOD) {
+	    if (opts->debug) pwdfile_log(opts, LOG_DEBUG, "passwords match");
+	    free(stored_crypted_password);
+	    return PWDFILE_OK;
+	}
+	if (cached == AUTHCACHE_BAD) {
+	    pwdfile_log(opts, LOG_NOTICE, "wrong password for user %s", user);
+	    free(stored_crypted_password);
+	    return PWDFILE_WRONG;
+	}
+    }
+    
+    if (!(ctx = cryptctx_get())) {
+	free(stored_crypted_password);
+	return PWDFILE_ERROR;
+    }
+    
+    if (opts->admit) {
+	units = crypt_units(opts, stored_crypted_password);
+	if (opts->debug) pwdfile_log(opts, LOG_DEBUG, "check takes %u MiB of crypt limit", units);
+	if (admit_enter(opts->admit, units, opts->crypt_wait) == -1) {
+	    if (errno == EAGAIN) {
+		pwdfile_log(opts, LOG_WARNING, "no room under crypt limit for user %s after %u ms",
+			    user, opts->crypt_wait);
+		free(stored_crypted_password);
+		return PWDFILE_UNAVAIL;
+	    }
+	    /* it only protects the host, don't refuse logins because it is gone */
+	    pwdfile_log(opts, LOG_ERR, "crypt limit failed, checking anyway: %m");
+	    units = 0;
+	}
+    }
+    
+    PROBE1(crypt__start, scheme_names[scheme]);
+    if (opts->stats)
+	start = stats_now();
+    if (opts->builtin_sha)
+	crypted_password = cryptctx_sha_crypt(ctx, password, stored_crypted_password);
+    else
+	crypted_password = cryptctx_crypt(ctx, password, stored_crypted_password);
+    if (units)
+	admit_leave(opts->admit, units);
+    if (!crypted_password) {
+	PROBE2(crypt__done, scheme_names[scheme], 0);
+	pwdfile_log(opts, LOG_ERR, "crypt() failed");
+	free(stored_crypted_password);
+	return PWDFILE_ERROR;
+    }
+    
+    if (opts->legacy_crypt && strcmp(crypted_password, stored_crypted_password)) {
+	if (!strncmp(stored_crypted_password, "$1$", 3))
+	    crypted_password = Brokencrypt_md5_r(password, stored_crypted_password, legacy_crypted);
+	else
+	    crypted_password = cryptctx_bigcrypt(ctx, password, stored_crypted_password);
+    }
+
+    PROBE2(crypt__done, scheme_names[scheme], crypted_password && !strcmp(crypted_password, stored_crypted_password));
+    if (opts->stats)
+	stats_time(opts->stats->crypt_us, stats_now() - start);
+    if (!crypted_password || strcmp(crypted_password, stored_crypted_password)) {
+	pwdfile_log(opts, LOG_NOTICE, "wrong password for user %s", user);
+	if (opts->authcache_ttl && opts->authcache_negative)
+	    authcache_store(user, stored_crypted_password, password, 0, opts->authcache_ttl);
+	retval = PWDFILE_WRONG;
+    } else {
+	if (opts->debug) pwdfile_log(opts, LOG_DEBUG, "passwords match");
+	if (opts->authcache_ttl)
+	    authcache_store(user, stored_crypted_password, password, 1, opts->authcache_ttl);
+	retval = PWDFILE_OK;
+	if (opts->rehash_prefix && scheme != scheme_of(opts->rehash_prefix))
+	    rehash(opts, ctx, user, stored_crypted_password, password);
+    }
+    cryptctx_wipe(ctx);
+    explicit_bzero(legacy_crypted, sizeof(legacy_crypted));
+    free(stored_crypted_password);
+    return retval;
+}
+
+static const enum stats_outcome outcomes[] = {
+    [PWDFILE_OK] = STATS_SUCCESS,
+    [PWDFILE_WRONG] = STATS_WRONG,
+    [PWDFILE_UNKNOWN] = STATS_UNKNOWN,
+    [PWDFILE_UNAVAIL] = STATS_UNAVAIL,
+    [PWDFILE_ERROR] = STATS_OTHER,
+};
+
+enum pwdfile_result pwdfile_verify(const struct pwdfile_options *opts, const char *user,
+				   const char *password) {
+    enum pwdfile_result retval;
+    char *line;
+    
+    if ((retval = pwdfile_lookup(opts, user, &line)) == PWDFILE_OK) {
+	retval = pwdfile_check(opts, user, line, password);
+	free(line);
+    }
+    if (opts->stats)
+	stats_add(&opts->stats->outcomes[outcomes[retval]], 1);
+    return retval;
+}
+
+/* users which[0] to which[n - 1] of pairs, all in the same file: an index or the cache, or one read of it */
+static void lookup_file(const struct pwdfile_options *opts, struct pwdfile_pair *pairs, const size_t *which,
+			size_t n, char *lines[]) {
+    const struct pwdtable *index = NULL;
+    struct pwdtable *table = NULL;
+    const char *found;
+    size_t i, hits = 0;
+    int retval = NO_INDEX;
+    
+    if (opts->indexname)
+	index = map_index(opts, &retval);
+    if (!index && retval == NO_INDEX && opts->shm_tablename) {
+	if (!(index = shm_table(opts, &table)) && !table)
+	    retval = PWDFILE_UNAVAIL;
+    } else if (!index && retval == NO_INDEX && !opts->use_cache && !(table = load_table(opts)))
+	retval = PWDFILE_UNAVAIL;
+    
+    PROBE1(lookup__start, "batch");
+    for (i = 0; i < n; i++) {
+	struct pwdfile_pair *pair = &pairs[which[i]];
+	char **line = &lines[which[i]];
+	
+	if (!user_valid(opts, pair->user))
+	    pair->result = PWDFILE_UNKNOWN;
+	else if (index || table) {
+	    found = pwdtable_lookup(index ? index : table, pair->user);
+	    if (found && !(*line = strdup(found)))
+		pair->result = PWDFILE_ERROR;
+	    else
+		pair->result = found ? PWDFILE_OK : PWDFILE_UNKNOWN;
+	} else if (retval == NO_INDEX) {
+	    /* the cache has the table already */
+	    if ((pair->result = cache_lookup(opts, pair->user, line)) == PWDFILE_OK && !*line)
+		pair->result = PWDFILE_UNKNOWN;
+	} else
+	    pair->result = retval;
+	hits += pair->result == PWDFILE_OK;
+    }
+    PROBE3(lookup__done, "batch", hits, n);
+    if (index)
+	pwdtable_unmap(index);
+    free(table);
+}
+
+static int by_shard(const void *a, const void *b, void *shards) {
+    unsigned x = ((const unsigned *) shards)[*(const size_t *) a];
+    unsigned y = ((const unsigned *) shards)[*(const size_t *) b];
+    
+    return x < y ? -1 : x > y;
+}
+
+void pwdfile_lookup_batch(const struct pwdfile_options *opts, struct pwdfile_pair *pairs, size_t n,
+			  char *lines[]) {
+    struct pwdfile_options shard_opts;
+    unsigned *shards = NULL;
+    size_t *which, i, j;
+    char *shardname;
+    
+    for (i = 0; i < n; i++)
+	lines[i] = NULL;
+    if (!(which = malloc(n * sizeof(*which))) || (opts->pwdfile_dir && !(shards = malloc(n * sizeof(*shards))))) {
+	for (i = 0; i < n; i++)
+	    pairs[i].result = PWDFILE_ERROR;
+	free(which);
+	return;
+    }
+    for (i = 0; i < n; i++)
+	which[i] = i;
+    
+    if (!opts->pwdfile_dir) {
+	if (opts->pwdfilename)
+	    lookup_file(opts, pairs, which, n, lines);
+	else {
+	    pwdfile_log(opts, LOG_ERR, "password file name not specified");
+	    for (i = 0; i < n; i++)
+		pairs[i].result = PWDFILE_UNAVAIL;
+	}
+	free(which);
+	return;
+    }
+    
+    /* each shard is read once, for all of its users */
+    for (i = 0; i < n; i++)
+	shards[i] = pwdtable_shard(pairs[i].user, strlen(pairs[i].user), opts->shards);
+    qsort_r(which, n, sizeof(*which), by_shard, shards);
+    for (i = 0; i < n; i = j) {
+	for (j = i + 1; j < n && shards[which[j]] == shards[which[i]]; j++)
+	    ;
+	if ((shardname = shard_options(opts, pairs[which[i]].user, &shard_opts))) {
+	    lookup_file(&shard_opts, pairs, which + i, j - i, lines);
+	    free(shardname);
+	} else
+	    while (i < j)
+		pairs[which[i++]].result = PWDFILE_ERROR;
+    }
+    free(shards);
+    free(which);
+}
+
+/*
+ * pairs found by pwdfile_lookup_batch, in the order they are checked:
+ * $1$ entries first, MD5_LANES of them in one unit of work, then one
+ * unit per other entry
+ */
+struct verify_batch {
+    const struct pwdfile_options *opts;
+    struct pwdfile_pair *pairs;
+    char **lines;
+    size_t *order;
+    size_t nmd5, md5_units;
+};
+
+static int md5_crypted(const char *line) {
+    const char *crypted;
+    
+    pwdfile_crypted(line, &crypted);
+    return !strncmp(crypted, "$1$", 3);
+}
+
+/* what doesn't match is wrong, unless legacy_crypt has pwdfile_check try the broken md5 too */
+static void check_md5(const struct verify_batch *batch, const size_t *which, int n) {
+    const char *passwords[MD5_LANES] = { NULL }, *crypted[MD5_LANES] = { NULL };
+    char out[MD5_LANES][MD5_CRYPT_OUTPUT_SIZE];
+    size_t len[MD5_LANES];
+    int i, ok;
+    
+    for (i = 0; i < n; i++) {
+	passwords[i] = batch->pairs[which[i]].password;
+	/* the salt ends at its '$', the rest of the line doesn't matter */
+	len[i] = pwdfile_crypted(batch->lines[which[i]], &crypted[i]);
+    }
+    PROBE1(crypt__start, "md5");
+    Goodcrypt_md5_multi(n, passwords, crypted, out);
+    for (i = 0; i < n; i++) {
+	struct pwdfile_pair *pair = &batch->pairs[which[i]];
+	
+	ok = strlen(out[i]) == len[i] && !strncmp(out[i], crypted[i], len[i]);
+	PROBE2(crypt__done, "md5", ok);
+	if (!ok && batch->opts->legacy_crypt) {
+	    pair->result = pwdfile_check(batch->opts, pair->user, batch->lines[which[i]], pair->password);
+	    continue;
+	}
+	if (batch->opts->stats)
+	    stats_add(&batch->opts->stats->schemes[SCHEME_MD5], 1);
+	if (ok)
+	    pair->result = PWDFILE_OK;
+	else {
+	    pwdfile_log(batch->opts, LOG_NOTICE, "wrong password for user %s", pair->user);
+	    pair->result = PWDFILE_WRONG;
+	}
+    }
+    explicit_bzero(out, sizeof(out));
+}
+
+static void verify_unit(void *arg, size_t unit) {
+    const struct verify_batch *batch = arg;
+    size_t i;
+    
+    if (unit < batch->md5_units) {
+	i = unit * MD5_LANES;
+	check_md5(batch, batch->order + i, batch->nmd5 - i < MD5_LANES ? batch->nmd5 - i : MD5_LANES);
+    } else {
+	i = batch->order[batch->nmd5 + unit - batch->md5_units];
+	batch->pairs[i].result = pwdfile_check(batch->opts, batch->pairs[i].user, batch->lines[i],
+					       batch->pairs[i].password);
+    }
+}
+
+void pwdfile_verify_batch(const struct pwdfile_options *opts, struct pwdfile_pair *pairs, size_t n) {
+    struct verify_batch batch = { opts, pairs };
+    size_t i, nother = 0;
+    /* authcache and rehash need pwdfile_check for each pair */
+    int multi = !opts->authcache_ttl && !opts->rehash_prefix;
+    
+    if (!(batch.lines = malloc(n * sizeof(*batch.lines))) || !(batch.order = malloc(n * sizeof(*batch.order)))) {
+	for (i = 0; i < n; i++)
+	    pairs[i].result = PWDFILE_ERROR;
+	free(batch.lines);
+	return;
+    }
+    pwdfile_lookup_batch(opts, pairs, n, batch.lines);
+    
+    for (i = 0; i < n; i++)
+	if (pairs[i].result == PWDFILE_OK && multi && md5_crypted(batch.lines[i]))
+	    batch.order[batch.nmd5++] = i;
+    for (i = 0; i < n; i++)
+	if (pairs[i].result == PWDFILE_OK && !(multi && md5_crypted(batch.lines[i])))
+	    batch.order[batch.nmd5 + nother++] = i;
+    batch.md5_units = (batch.nmd5 + MD5_LANES - 1) / MD5_LANES;
+    if (opts->debug) pwdfile_log(opts, LOG_DEBUG, "verifying %zu of %zu users, %zu of them md5_crypt",
+				 batch.nmd5 + nother, n, batch.nmd5);
+    batch_run(batch.md5_units + nother, verify_unit, &batch);
+    
+    for (i = 0; i < n; i++) {
+	free(batch.lines[i]);
+	if (opts->stats)
+	    stats_add(&opts->stats->outcomes[outcomes[pairs[i].result]], 1);
+    }
+    free(batch.order);
+    free(batch.lines);
+}
@@ -0,0 +1,96 @@
+#ifndef PWDFILE_H
+#define PWDFILE_H
+
+#include <stdarg.h>
+#include <stddef.h>
+
+/*
+ * libpwdfile: the lookup and password check of pam_pwdfile, for programs
+ * that want to verify logins against a password file without PAM.
+ *
+ * Options are the module arguments, see README; pwdfile_options_parse
+ * only keeps pointers into argv, which must outlive the options.
+ * pwdfile_verify blocks for the whole crypt() cost, pwdfile_verify_async
+ * hands the work to a pool of one thread per available CPU and calls
+ * done from one of them.
+ * pwdfile_verify_batch is for many logins at once, e.g. queued ones.
+ */
+
+#define PWDFILE_API __attribute__((visibility("default")))
+
+#define PWDFILE_SHARDS	256	/* default for pwdfile_dir */
+
+enum pwdfile_result {
+	PWDFILE_OK,
+	PWDFILE_WRONG,		/* wrong password */
+	PWDFILE_UNKNOWN,	/* user not in pwdfile */
+	PWDFILE_UNAVAIL,	/* pwdfile missing or unreadable */
+	PWDFILE_ERROR,		/* out of memory, crypt() failed */
+};
+
+enum pwdfile_account {
+	PWDFILE_ACCOUNT_OK,
+	PWDFILE_ACCOUNT_LOCKED,		/* crypt field starts with '!' */
+	PWDFILE_ACCOUNT_EXPIRED,	/* expire_field is today or before */
+};
+
+struct pwdfile_options;
+
+typedef void pwdfile_log_fn(void *log_arg, int priority, const char *fmt, va_list ap);
+
+typedef void pwdfile_done_fn(enum pwdfile_result result, void *arg);
+
+struct pwdfile_pair {
+	const char *user;
+	const char *password;
+	enum pwdfile_result result;
+};
+
+/* the defaults; NULL if out of memory */
+PWDFILE_API struct pwdfile_options *pwdfile_options_new(void);
+PWDFILE_API void pwdfile_options_free(struct pwdfile_options *opts);
+/* may be called again, later arguments override earlier ones */
+PWDFILE_API void pwdfile_options_parse(struct pwdfile_options *opts, int argc, const char **argv);
+/* messages go to syslog(3) unless log is set */
+PWDFILE_API void pwdfile_options_set_log(struct pwdfile_options *opts, pwdfile_log_fn *log, void *log_arg);
+
+/* the line of user, malloc()ed; PWDFILE_UNKNOWN leaves *line NULL */
+PWDFILE_API enum pwdfile_result pwdfile_lookup(const struct pwdfile_options *opts, const char *user, char **line);
+/* where the crypt field of such a line starts and how long it is */
+PWDFILE_API size_t pwdfile_crypted(const char *line, const char **crypted);
+/* field n of such a line, counted from 1; NULL and 0 if it has fewer */
+PWDFILE_API size_t pwdfile_field(const char *line, unsigned n, const char **field);
+/* an empty crypt field only matches an empty password; PWDFILE_UNAVAIL when crypt_limit has no room */
+PWDFILE_API enum pwdfile_result pwdfile_check(const struct pwdfile_options *opts, const char *user,
+					      const char *line, const char *password);
+
+/*
+ * replace the crypt field of user by crypted, if it still is old, by
+ * writing a new pwdfile and renaming it into place under an exclusive
+ * flock; PWDFILE_WRONG if the field changed meanwhile. A current index
+ * and the cache of this process are patched, not built again.
+ */
+PWDFILE_API enum pwdfile_result pwdfile_update(const struct pwdfile_options *opts, const char *user,
+					       const char *old, const char *crypted);
+/* pwdfile_update with a new hash of password, in the rehash= scheme or else that of old */
+PWDFILE_API enum pwdfile_result pwdfile_change(const struct pwdfile_options *opts, const char *user,
+					       const char *old, const char *password);
+
+/* whether the user of a line may log in, independent of the password */
+PWDFILE_API enum pwdfile_account pwdfile_account(const struct pwdfile_options *opts, const char *line);
+
+PWDFILE_API enum pwdfile_result pwdfile_verify(const struct pwdfile_options *opts, const char *user,
+					       const char *password);
+/*
+ * pwdfile_lookup of many users reading pwdfile, or each shard, once:
+ * result is PWDFILE_OK with lines[i] malloc()ed, or why not
+ */
+PWDFILE_API void pwdfile_lookup_batch(const struct pwdfile_options *opts, struct pwdfile_pair *pairs, size_t n,
+				      char *lines[]);
+/* pwdfile_verify of many pairs, crypt() on all available CPUs; the results are in pairs */
+PWDFILE_API void pwdfile_verify_batch(const struct pwdfile_options *opts, struct pwdfile_pair *pairs, size_t n);
+/* opts must stay valid until done was called; -1 with errno set if the work couldn't be queued */
+PWDFILE_API int pwdfile_verify_async(const struct pwdfile_options *opts, const char *user, const char *password,
+				     pwdfile_done_fn *done, void *arg);
+
+#endif				/* PWDFILE_H */
@@ -0,0 +1,227 @@
+/*
+ * pwdfile_audit: count the hash schemes in password files and estimate
+ * what verifying their passwords costs, e.g. before migrating them with
+ * the rehash= option of pam_pwdfile.
+ *
+ * usage: pwdfile_audit <pwdfile or dir>...
+ * Entries are grouped by scheme and cost parameters; for each group one
+ * crypt() of a wrong password is timed, the best of a few runs, with the
+ * group's first entry as salt. A bigcrypt entry is checked by crypt()
+ * first and then by bigcrypt(), which costs one DES per 8 characters of
+ * password; groups are by number of segments. Directories are read as
+ * the shards of pwdfile_dir.
+ *
+ * This file may be distributed under the same terms as pam_pwdfile.c.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#include "cryptctx.h"
+#include "scheme.h"
+
+#define RUNS	3
+
+struct group {
+	enum scheme scheme;
+	char *setting;
+	char *sample;		/* crypt string to time */
+	unsigned long entries;
+	double ms;		/* per verification, < 0 if crypt() failed */
+};
+
+static const char *prog;
+static struct group *groups;
+static size_t ngroups;
+
+static int fail(const char *what) {
+	fprintf(stderr, "%s: %s: %s\n", prog, what, strerror(errno));
+	return 1;
+}
+
+/* the prefix and cost parameters of a crypt string, without salt and hash */
+static char *setting_of(const char *crypted, enum scheme scheme) {
+	const char *last, *p;
+	char *setting;
+
+	switch (scheme) {
+	case SCHEME_EMPTY:
+	case SCHEME_DES:
+		return strdup("");
+	case SCHEME_BIGCRYPT:
+		return asprintf(&setting, "%zu segments", (strlen(crypted) - 2) / 11) == -1 ? NULL : setting;
+	case SCHEME_BSDI:
+		/* _ and 4 characters of rounds */
+		return strndup(crypted, 5);
+	case SCHEME_BCRYPT:
+		/* $2b$<cost>$, salt and hash follow without a separator */
+		p = strchr(crypted + 1, '$');
+		p = p ? strchr(p + 1, '$') : NULL;
+		return p ? strndup(crypted, p + 1 - crypted) : strdup(crypted);
+	default:
+		/* $id$[params$]salt$hash */
+		if (*crypted != '$' || !(last = strrchr(crypted, '$')) || last == crypted)
+			return strdup("");
+		for (p = last - 1; p > crypted && *p != '$'; p--)
+			;
+		return strndup(crypted, p + 1 - crypted);
+	}
+}
+
+static double now_ms(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static double measure(struct cryptctx *ctx, const struct group *group) {
+	double best = -1, start, ms;
+	const char *crypted;
+	int i;
+
+	if (group->scheme == SCHEME_EMPTY)
+		return 0;
+	for (i = 0; i < RUNS; i++) {
+		start = now_ms();
+		crypted = cryptctx_crypt(ctx, "pwdfile_audit", group->sample);
+		if (crypted && group->scheme == SCHEME_BIGCRYPT)
+			crypted = cryptctx_bigcrypt(ctx, "pwdfile_audit", group->sample);
+		ms = now_ms() - start;
+		if (!crypted || *crypted == '*')
+			return -1;
+		if (best < 0 || ms < best)
+			best = ms;
+	}
+	return best;
+}
+
+static int add(const char *crypted) {
+	enum scheme scheme = scheme_of(crypted);
+	struct group *group;
+	char *setting;
+	size_t i;
+
+	if (!(setting = setting_of(crypted, scheme)))
+		return -1;
+	for (i = 0; i < ngroups; i++)
+		if (groups[i].scheme == scheme && !strcmp(groups[i].setting, setting)) {
+			groups[i].entries++;
+			free(setting);
+			return 0;
+		}
+	if (!(group = reallocarray(groups, ngroups + 1, sizeof(*groups)))) {
+		free(setting);
+		return -1;
+	}
+	groups = group;
+	group += ngroups++;
+	group->scheme = scheme;
+	group->setting = setting;
+	group->entries = 1;
+	return (group->sample = strdup(crypted)) ? 0 : -1;
+}
+
+static char *line;
+static size_t linelen;
+
+static int audit(const char *path) {
+	FILE *in = fopen(path, "r");
+	char *crypted;
+	ssize_t n;
+
+	if (!in)
+		return fail(path);
+	while ((n = getline(&line, &linelen, in)) > 0) {
+		/* lines without a password field never match */
+		if (!(crypted = memchr(line, ':', n)))
+			continue;
+		crypted[1 + strcspn(crypted + 1, ":\n")] = '\0';
+		if (add(crypted + 1) == -1)
+			return fail("malloc");
+	}
+	if (ferror(in))
+		return fail(path);
+	fclose(in);
+	return 0;
+}
+
+/* the shards of a directory, not their indexes */
+static int audit_dir(const char *path) {
+	DIR *dir = opendir(path);
+	struct dirent *entry;
+	char *name;
+
+	if (!dir)
+		return fail(path);
+	while ((entry = readdir(dir))) {
+		if (strlen(entry->d_name) != 4 || strspn(entry->d_name, "0123456789abcdef") != 4)
+			continue;
+		if (asprintf(&name, "%s/%s", path, entry->d_name) == -1)
+			return fail("asprintf");
+		if (audit(name))
+			return 1;
+		free(name);
+	}
+	closedir(dir);
+	return 0;
+}
+
+/* most expensive first */
+static int by_total(const void *a, const void *b) {
+	const struct group *x = a, *y = b;
+	double tx = x->entries * x->ms, ty = y->entries * y->ms;
+
+	return tx < ty ? 1 : tx > ty ? -1 : 0;
+}
+
+int main(int argc, char **argv) {
+	struct cryptctx *ctx;
+	unsigned long entries = 0;
+	double total = 0;
+	int i;
+	size_t g;
+
+	prog = argv[0];
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <pwdfile or dir>...\n", argv[0]);
+		return 2;
+	}
+	for (i = 1; i < argc; i++) {
+		struct stat st;
+
+		if (stat(argv[i], &st) == -1)
+			return fail(argv[i]);
+		if (S_ISDIR(st.st_mode) ? audit_dir(argv[i]) : audit(argv[i]))
+			return 1;
+	}
+
+	if (!(ctx = cryptctx_get()))
+		return fail("cryptctx_get");
+	for (g = 0; g < ngroups; g++)
+		groups[g].ms = measure(ctx, &groups[g]);
+	qsort(groups, ngroups, sizeof(*groups), by_total);
+
+	printf("%-14s %-20s %10s %12s %12s\n", "scheme", "setting", "entries", "ms/verify", "total s");
+	for (g = 0; g < ngroups; g++) {
+		const struct group *group = &groups[g];
+
+		entries += group->entries;
+		if (group->ms < 0) {
+			printf("%-14s %-20s %10lu %12s %12s\n", scheme_names[group->scheme], group->setting,
+			       group->entries, "-", "-");
+			continue;
+		}
+		total += group->entries * group->ms / 1e3;
+		printf("%-14s %-20s %10lu %12.3f %12.3f\n", scheme_names[group->scheme], group->setting,
+		       group->entries, group->ms, group->entries * group->ms / 1e3);
+	}
+	printf("%-14s %-20s %10lu %12s %12.3f\n", "total", "", entries, "", total);
+	return 0;
+}
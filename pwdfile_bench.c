@@ -0,0 +1,287 @@
+/*
+ * pwdfile_bench: measure pam_sm_authenticate on synthetic password files.
+ *
+ * usage: pwdfile_bench [-u users,...] [-t threads,...] [-s scheme,...] [-d seconds]
+ *                      [-- module options]
+ *
+ * For each number of users a password file is generated with the given
+ * schemes mixed round-robin (des, bigcrypt, md5, sha256, sha512, bcrypt,
+ * yescrypt), then every combination of thread count and case
+ * (hit: right password, wrong: wrong password, miss: unknown user) runs
+ * for the given time.  Each result is printed as one line of JSON.
+ * Module options are passed after pwdfile=<generated file>.
+ *
+ * This file may be distributed under the same terms as pam_pwdfile.c.
+ */
+
+#define _GNU_SOURCE
+#include <crypt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <security/pam_appl.h>
+#include <security/pam_modules.h>
+
+#include "bigcrypt.h"
+#include "pam_stub.h"
+
+#define PASSWORDS 4	/* distinct passwords, hashed once per scheme */
+
+int pam_sm_authenticate(pam_handle_t *pamh, int flags, int argc, const char **argv);
+
+static const struct scheme {
+	const char *name;
+	const char *setting;	/* NULL: from crypt_gensalt */
+	const char *prefix;
+} all_schemes[] = {
+	{ "des",	"xy",		"" },
+	{ "bigcrypt",	"xy",		"" },
+	{ "md5",	"$1$saltsalt$",	"$1$" },
+	{ "sha256",	"$5$saltsaltsaltsalt$",	"$5$" },
+	{ "sha512",	"$6$saltsaltsaltsalt$",	"$6$" },
+	{ "bcrypt",	NULL,		"$2b$" },
+	{ "yescrypt",	NULL,		"$y$" },
+};
+#define NSCHEMES (sizeof(all_schemes) / sizeof(all_schemes[0]))
+
+enum bench_case { CASE_HIT, CASE_WRONG, CASE_MISS };
+static const char *case_names[] = { "hit", "wrong", "miss" };
+
+static char hashes[NSCHEMES][PASSWORDS][CRYPT_OUTPUT_SIZE];
+static const struct scheme *schemes[NSCHEMES];
+static int nschemes;
+
+static int module_argc;
+static const char **module_argv;
+static double duration = 2;
+
+struct worker {
+	pthread_t thread;
+	unsigned seed;
+	long users;
+	enum bench_case bench_case;
+	uint64_t *lat;
+	size_t nlat, alloc;
+	long failures;		/* results other than expected */
+};
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void password(char *buf, size_t len, long k, int wrong) {
+	snprintf(buf, len, "%s-%ld", wrong ? "wrongpw" : "password", k % PASSWORDS);
+}
+
+static int make_hashes(void) {
+	struct crypt_data data;
+	char pw[32], setting[CRYPT_GENSALT_OUTPUT_SIZE];
+	const char *crypted;
+	int s, k;
+
+	data.initialized = 0;
+	for (s = 0; s < nschemes; s++)
+		for (k = 0; k < PASSWORDS; k++) {
+			const char *set = schemes[s]->setting;
+
+			password(pw, sizeof(pw), k, 0);
+			if (!set && !(set = crypt_gensalt_rn(schemes[s]->prefix, 0, NULL, 0, setting, sizeof(setting)))) {
+				fprintf(stderr, "pwdfile_bench: no %s in this libcrypt\n", schemes[s]->name);
+				return -1;
+			}
+			if (!strcmp(schemes[s]->name, "bigcrypt"))
+				crypted = bigcrypt_r(pw, set, hashes[s][k], &data);
+			else
+				crypted = crypt_r(pw, set, &data);
+			if (!crypted || *crypted == '*') {
+				fprintf(stderr, "pwdfile_bench: couldn't make %s hash\n", schemes[s]->name);
+				return -1;
+			}
+			/* bigcrypt_r wrote it there already */
+			if (crypted != hashes[s][k])
+				strcpy(hashes[s][k], crypted);
+		}
+	return 0;
+}
+
+static int write_pwdfile(const char *path, long users) {
+	FILE *f = fopen(path, "w");
+	long i;
+
+	if (!f)
+		return -1;
+	for (i = 0; i < users; i++)
+		fprintf(f, "user%ld:%s:%ld:100::/home/user%ld:/bin/false\n",
+			i, hashes[i % nschemes][(i / nschemes) % PASSWORDS], 10000 + i, i);
+	return fclose(f);
+}
+
+static void *work(void *arg) {
+	struct worker *w = arg;
+	struct pam_handle pamh;
+	char user[32], pw[32];
+	uint64_t start = now_ns(), end = start + duration * 1e9, t0, t1;
+
+	memset(&pamh, 0, sizeof(pamh));
+	do {
+		long i = rand_r(&w->seed) % w->users;
+		int retval;
+
+		if (w->bench_case == CASE_MISS)
+			snprintf(user, sizeof(user), "nouser%ld", i);
+		else
+			snprintf(user, sizeof(user), "user%ld", i);
+		password(pw, sizeof(pw), i / nschemes, w->bench_case == CASE_WRONG);
+		pamh.user = user;
+		pamh.authtok = pw;
+
+		t0 = now_ns();
+		retval = pam_sm_authenticate(&pamh, 0, module_argc, module_argv);
+		t1 = now_ns();
+		pam_stub_end(&pamh);
+
+		if (retval != (w->bench_case == CASE_HIT ? PAM_SUCCESS
+			       : w->bench_case == CASE_WRONG ? PAM_AUTH_ERR : PAM_USER_UNKNOWN))
+			++w->failures;
+		if (w->nlat == w->alloc) {
+			uint64_t *lat = realloc(w->lat, (w->alloc = w->alloc ? 2 * w->alloc : 4096) * sizeof(*lat));
+			if (!lat)
+				break;
+			w->lat = lat;
+		}
+		w->lat[w->nlat++] = t1 - t0;
+	} while (t1 < end);
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void run(long users, int threads, enum bench_case bench_case) {
+	struct worker *workers = calloc(threads, sizeof(*workers));
+	uint64_t *lat, start, elapsed;
+	size_t n = 0;
+	long failures = 0;
+	int i;
+
+	if (!workers)
+		return;
+	start = now_ns();
+	for (i = 0; i < threads; i++) {
+		workers[i].seed = i + 1;
+		workers[i].users = users;
+		workers[i].bench_case = bench_case;
+		pthread_create(&workers[i].thread, NULL, work, &workers[i]);
+	}
+	for (i = 0; i < threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		n += workers[i].nlat;
+		failures += workers[i].failures;
+	}
+	elapsed = now_ns() - start;
+
+	/* no latencies if every worker ran out of memory */
+	if (!n)
+		fprintf(stderr, "pwdfile_bench: no %s authentication was measured\n", case_names[bench_case]);
+	else if ((lat = malloc(n * sizeof(*lat)))) {
+		size_t off = 0;
+
+		for (i = 0; i < threads; i++) {
+			memcpy(lat + off, workers[i].lat, workers[i].nlat * sizeof(*lat));
+			off += workers[i].nlat;
+		}
+		qsort(lat, n, sizeof(*lat), cmp_u64);
+		printf("{\"users\":%ld,\"threads\":%d,\"case\":\"%s\",\"ops\":%zu,\"failures\":%ld,"
+		       "\"ops_per_sec\":%.1f,\"p50_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f,\"options\":\"",
+		       users, threads, case_names[bench_case], n, failures,
+		       n * 1e9 / elapsed, lat[n / 2] / 1e3, lat[n * 99 / 100] / 1e3, lat[n - 1] / 1e3);
+		/* without the generated pwdfile= */
+		for (i = 1; i < module_argc; i++)
+			printf("%s%s", i > 1 ? " " : "", module_argv[i]);
+		printf("\"}\n");
+		fflush(stdout);
+		free(lat);
+	}
+	for (i = 0; i < threads; i++)
+		free(workers[i].lat);
+	free(workers);
+}
+
+int main(int argc, char **argv) {
+	const char *user_counts = "1000,100000", *thread_counts = "1,4", *scheme_list = "des,md5,sha256,sha512";
+	char path[] = "/tmp/pwdfile_bench.XXXXXX", *pwdfile_arg, *list, *tok;
+	int opt, fd, i, legacy = 0;
+
+	while ((opt = getopt(argc, argv, "u:t:s:d:")) != -1) {
+		switch (opt) {
+		case 'u': user_counts = optarg; break;
+		case 't': thread_counts = optarg; break;
+		case 's': scheme_list = optarg; break;
+		case 'd': duration = atof(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [-u users,...] [-t threads,...] [-s scheme,...] [-d seconds] [-- module options]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	list = strdup(scheme_list);
+	for (tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+		for (i = 0; i < (int) NSCHEMES && strcmp(all_schemes[i].name, tok); i++)
+			;
+		if (i == NSCHEMES || nschemes == NSCHEMES) {
+			fprintf(stderr, "pwdfile_bench: unknown scheme %s\n", tok);
+			return 2;
+		}
+		if (!strcmp(tok, "bigcrypt"))
+			legacy = 1;
+		schemes[nschemes++] = &all_schemes[i];
+	}
+	if (!nschemes || make_hashes() == -1)
+		return 1;
+
+	if ((fd = mkstemp(path)) == -1) {
+		perror("pwdfile_bench");
+		return 1;
+	}
+	close(fd);
+	if (asprintf(&pwdfile_arg, "pwdfile=%s", path) == -1)
+		return 1;
+
+	module_argv = calloc(argc - optind + 3, sizeof(*module_argv));
+	module_argv[module_argc++] = pwdfile_arg;
+	module_argv[module_argc++] = "nodelay";
+	if (legacy)
+		module_argv[module_argc++] = "legacy_crypt";
+	for (i = optind; i < argc; i++)
+		module_argv[module_argc++] = argv[i];
+
+	list = strdup(user_counts);
+	for (tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+		long users = atol(tok);
+		char *tlist, *ttok, *save;
+		int c;
+
+		if (users < 1 || write_pwdfile(path, users) == -1) {
+			perror("pwdfile_bench");
+			break;
+		}
+		tlist = strdup(thread_counts);
+		for (ttok = strtok_r(tlist, ",", &save); ttok; ttok = strtok_r(NULL, ",", &save))
+			for (c = CASE_HIT; c <= CASE_MISS; c++)
+				run(users, atoi(ttok), c);
+		free(tlist);
+	}
+	unlink(path);
+	return 0;
+}
@@ -0,0 +1,55 @@
+/*
+ * pwdfile_compile: turn a password file into an index for the
+ * pwdfile_index option of pam_pwdfile.
+ *
+ * usage: pwdfile_compile <pwdfile> [<index>]
+ * The index defaults to <pwdfile>.idx and is replaced atomically.
+ * It has to be rebuilt whenever pwdfile changes, until then the module
+ * ignores it. It holds every hash, so it gets the owner and mode of
+ * pwdfile.
+ *
+ * This file may be distributed under the same terms as pam_pwdfile.c.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "pwdtable.h"
+
+int main(int argc, char **argv) {
+	struct pwdtable *table;
+	struct stat st;
+	char *index;
+	int fd;
+
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "usage: %s <pwdfile> [<index>]\n", argv[0]);
+		return 2;
+	}
+	if (argc == 3)
+		index = argv[2];
+	else if (asprintf(&index, "%s.idx", argv[1]) == -1)
+		return 1;
+
+	if ((fd = open(argv[1], O_RDONLY)) == -1) {
+		fprintf(stderr, "%s: %s: %s\n", argv[0], argv[1], strerror(errno));
+		return 1;
+	}
+	if (fstat(fd, &st) == -1 || !(table = pwdtable_build(fd))) {
+		fprintf(stderr, "%s: %s: %s\n", argv[0], argv[1], strerror(errno));
+		return 1;
+	}
+	close(fd);
+
+	if (pwdtable_write(table, index, &st) == -1) {
+		fprintf(stderr, "%s: %s: %s\n", argv[0], index, strerror(errno));
+		return 1;
+	}
+	return 0;
+}
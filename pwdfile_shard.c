@@ -0,0 +1,194 @@
+/*
+ * pwdfile_shard: split password files into the shard files of a
+ * directory for the pwdfile_dir option of pam_pwdfile.
+ *
+ * usage: pwdfile_shard [-n <shards>] [-i] <dir> <pwdfile or old dir>...
+ * Users go to shard <dir>/%04x by the hash of their name, in the order
+ * of the input, so the first line of a user still wins. To reshard,
+ * pass the old directory as input and a new directory: its shards are
+ * read, a user can only be in one of them.
+ * Every shard is written, empty ones too, and each is replaced
+ * atomically; -i also compiles an index next to each.
+ * All shards are open at the same time, many of them may need a higher
+ * limit of open files.
+ * Shards and indexes get the owner of the first input file and the
+ * permissions all input files have in common, a new directory the same
+ * plus search permission; until the input is read it is private.
+ *
+ * This file may be distributed under the same terms as pam_pwdfile.c.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#include "pwdfile.h"
+#include "pwdtable.h"
+
+struct shard {
+	char *path;
+	char *tmp;
+	FILE *file;
+};
+
+static const char *prog;
+
+static int fail(const char *what) {
+	fprintf(stderr, "%s: %s: %s\n", prog, what, strerror(errno));
+	return 1;
+}
+
+static char *line;
+static size_t linelen;
+/* owner and mode for the output, from the input files */
+static struct stat like = { .st_mode = 0600 };
+static int read_any;
+
+static int split(const char *path, struct shard *shards, unsigned nshards) {
+	FILE *in = fopen(path, "r");
+	struct stat st;
+	ssize_t n;
+
+	if (!in)
+		return fail(path);
+	if (fstat(fileno(in), &st) == -1)
+		return fail(path);
+	if (!read_any++) {
+		like.st_uid = st.st_uid;
+		like.st_gid = st.st_gid;
+		like.st_mode = st.st_mode & 0644;
+	} else
+		like.st_mode &= st.st_mode;
+	while ((n = getline(&line, &linelen, in)) > 0) {
+		char *colon = memchr(line, ':', n);
+		FILE *out;
+
+		/* lines without a password field never match */
+		if (!colon)
+			continue;
+		out = shards[pwdtable_shard(line, colon - line, nshards)].file;
+		fwrite(line, 1, n, out);
+		if (line[n - 1] != '\n')
+			fputc('\n', out);
+	}
+	if (ferror(in))
+		return fail(path);
+	fclose(in);
+	return 0;
+}
+
+/* the shards of an old directory, not their indexes */
+static int split_dir(const char *path, struct shard *shards, unsigned nshards) {
+	DIR *dir = opendir(path);
+	struct dirent *entry;
+	char *name;
+
+	if (!dir)
+		return fail(path);
+	while ((entry = readdir(dir))) {
+		if (strlen(entry->d_name) != 4 || strspn(entry->d_name, "0123456789abcdef") != 4)
+			continue;
+		if (asprintf(&name, "%s/%s", path, entry->d_name) == -1)
+			return fail("asprintf");
+		if (split(name, shards, nshards))
+			return 1;
+		free(name);
+	}
+	closedir(dir);
+	return 0;
+}
+
+static int compile(const char *path) {
+	struct pwdtable *table;
+	char *index;
+	int fd, ret;
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return fail(path);
+	table = pwdtable_build(fd);
+	close(fd);
+	if (!table)
+		return fail(path);
+	if (asprintf(&index, "%s.idx", path) == -1)
+		return fail(path);
+	ret = pwdtable_write(table, index, &like) == -1 ? fail(index) : 0;
+	free(index);
+	free(table);
+	return ret;
+}
+
+int main(int argc, char **argv) {
+	struct shard *shards;
+	unsigned nshards = PWDFILE_SHARDS, i;
+	int opt, use_index = 0, ret = 0, created;
+
+	prog = argv[0];
+	while ((opt = getopt(argc, argv, "n:i")) != -1) {
+		switch (opt) {
+		case 'n':
+			nshards = strtoul(optarg, NULL, 10);
+			if (!nshards || nshards > 65536)
+				goto usage;
+			break;
+		case 'i':
+			use_index = 1;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (argc - optind < 2)
+		goto usage;
+
+	if (!(created = mkdir(argv[optind], 0700) == 0) && errno != EEXIST)
+		return fail(argv[optind]);
+	if (!(shards = calloc(nshards, sizeof(*shards))))
+		return fail("calloc");
+	for (i = 0; i < nshards; i++) {
+		int fd;
+
+		if (asprintf(&shards[i].path, "%s/%04x", argv[optind], i) == -1
+		    || asprintf(&shards[i].tmp, "%s.XXXXXX", shards[i].path) == -1)
+			return fail("asprintf");
+		if ((fd = mkstemp(shards[i].tmp)) == -1 || !(shards[i].file = fdopen(fd, "w")))
+			return fail(shards[i].tmp);
+	}
+
+	for (i = optind + 1; i < (unsigned) argc; i++) {
+		struct stat st;
+
+		if (stat(argv[i], &st) == -1)
+			return fail(argv[i]);
+		if (S_ISDIR(st.st_mode) ? split_dir(argv[i], shards, nshards) : split(argv[i], shards, nshards))
+			return 1;
+	}
+
+	for (i = 0; i < nshards; i++) {
+		if (fflush(shards[i].file) == EOF
+		    || (fchown(fileno(shards[i].file), like.st_uid, like.st_gid) == -1 && errno != EPERM)
+		    || fchmod(fileno(shards[i].file), like.st_mode) == -1
+		    || fsync(fileno(shards[i].file)) == -1 || fclose(shards[i].file) == EOF
+		    || rename(shards[i].tmp, shards[i].path) == -1) {
+			ret = fail(shards[i].path);
+			unlink(shards[i].tmp);
+			continue;
+		}
+		if (use_index && compile(shards[i].path))
+			ret = 1;
+	}
+	/* x where r, so that who may read the shards can reach them */
+	if (created && ((chown(argv[optind], like.st_uid, like.st_gid) == -1 && errno != EPERM)
+			|| chmod(argv[optind], like.st_mode | (like.st_mode & 0444) >> 2) == -1))
+		ret = fail(argv[optind]);
+	return ret;
+
+usage:
+	fprintf(stderr, "usage: %s [-n <shards>] [-i] <dir> <pwdfile or old dir>...\n", argv[0]);
+	return 2;
+}
@@ -0,0 +1,104 @@
+/*
+ * pwdfile_stats: print the counters pam_pwdfile keeps in the file given
+ * with its stats= option.
+ *
+ * usage: pwdfile_stats [-j] <stats file>
+ * -j prints one JSON object instead of text.
+ *
+ * This file may be distributed under the same terms as pam_pwdfile.c.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "scheme.h"
+#include "stats.h"
+
+static uint64_t get(const uint64_t *counter) {
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static void text_histogram(const char *name, const uint64_t *histogram) {
+	int i;
+
+	printf("%s:\n", name);
+	for (i = 0; i < STATS_BUCKETS; i++) {
+		if (!get(&histogram[i]))
+			continue;
+		if (i == 0)
+			printf("  <1us\t%" PRIu64 "\n", get(&histogram[i]));
+		else
+			printf("  >=%" PRIu64 "us\t%" PRIu64 "\n", (uint64_t) 1 << (i - 1), get(&histogram[i]));
+	}
+}
+
+static void text(const struct stats *stats) {
+	int i;
+
+	for (i = 0; i < STATS_OUTCOMES; i++)
+		printf("%s\t%" PRIu64 "\n", stats_outcome_names[i], get(&stats->outcomes[i]));
+	for (i = 0; i < SCHEME_COUNT; i++)
+		if (get(&stats->schemes[i]))
+			printf("scheme %s\t%" PRIu64 "\n", scheme_names[i], get(&stats->schemes[i]));
+	printf("lock_waits\t%" PRIu64 "\n", get(&stats->lock_waits));
+	printf("lock_wait_ns\t%" PRIu64 "\n", get(&stats->lock_wait_ns));
+	printf("reloads\t%" PRIu64 "\n", get(&stats->reloads));
+	text_histogram("lookup", stats->lookup_us);
+	text_histogram("crypt", stats->crypt_us);
+}
+
+/* upper bounds in us are implied by the bucket index */
+static void json_histogram(const char *name, const uint64_t *histogram) {
+	int i;
+
+	printf(",\"%s_us\":[", name);
+	for (i = 0; i < STATS_BUCKETS; i++)
+		printf("%s%" PRIu64, i ? "," : "", get(&histogram[i]));
+	printf("]");
+}
+
+static void json(const struct stats *stats) {
+	int i;
+
+	printf("{\"outcomes\":{");
+	for (i = 0; i < STATS_OUTCOMES; i++)
+		printf("%s\"%s\":%" PRIu64, i ? "," : "", stats_outcome_names[i], get(&stats->outcomes[i]));
+	printf("},\"schemes\":{");
+	for (i = 0; i < SCHEME_COUNT; i++)
+		printf("%s\"%s\":%" PRIu64, i ? "," : "", scheme_names[i], get(&stats->schemes[i]));
+	printf("},\"lock_waits\":%" PRIu64 ",\"lock_wait_ns\":%" PRIu64 ",\"reloads\":%" PRIu64,
+	       get(&stats->lock_waits), get(&stats->lock_wait_ns), get(&stats->reloads));
+	json_histogram("lookup", stats->lookup_us);
+	json_histogram("crypt", stats->crypt_us);
+	printf("}\n");
+}
+
+int main(int argc, char **argv) {
+	const struct stats *stats;
+	int opt, use_json = 0;
+
+	while ((opt = getopt(argc, argv, "j")) != -1) {
+		if (opt != 'j')
+			goto usage;
+		use_json = 1;
+	}
+	if (optind + 1 != argc)
+		goto usage;
+
+	if (!(stats = stats_map(argv[optind]))) {
+		fprintf(stderr, "%s: %s: %s\n", argv[0], argv[optind], strerror(errno));
+		return 1;
+	}
+	if (use_json)
+		json(stats);
+	else
+		text(stats);
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-j] <stats file>\n", argv[0]);
+	return 2;
+}
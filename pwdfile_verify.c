@@ -0,0 +1,145 @@
+/*
+ * pwdfile_verify: check many passwords against a password file at once,
+ * e.g. to audit which entries still accept known passwords, or to
+ * validate a migration.
+ *
+ * usage: pwdfile_verify [-l] <pwdfile> [<module option>...] < user:password lines
+ *        pwdfile_verify -s <socket> < user:password lines
+ * Prints "<user> ok", "<user> wrong", "<user> unknown", "<user> unavail"
+ * or "<user> error" for each input line, in input order.
+ * -l also accepts broken md5_crypt and bigcrypt, like the legacy_crypt
+ * option. Other options are those of the module, e.g. pwdfile_dir= to
+ * check against shards instead, or pwdfile_index=.
+ * pwdfile is read once; md5_crypt ($1$) entries are hashed together,
+ * MD5_LANES at a time, and the hashing is spread over all CPUs.
+ * -s asks a running pwdfiled instead, with up to WINDOW requests in
+ * flight, e.g. to check that it gives the same results.
+ *
+ * This file may be distributed under the same terms as pam_pwdfile.c.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <syslog.h>
+
+#include "pwdfile.h"
+#include "pwdproto.h"
+
+/* requests sent to pwdfiled before waiting for answers, their answers fit in the socket buffer */
+#define WINDOW		256
+#define TIMEOUT		60000	/* ms */
+
+static const char *const results[] = {
+	[PWDFILE_OK] = "ok",
+	[PWDFILE_WRONG] = "wrong",
+	[PWDFILE_UNKNOWN] = "unknown",
+	[PWDFILE_UNAVAIL] = "unavail",
+	[PWDFILE_ERROR] = "error",
+};
+
+/* wrong passwords are the point here, only problems go to stderr */
+static void log_stderr(void *unused, int priority, const char *fmt, va_list ap) {
+	if (priority > LOG_ERR)
+		return;
+	fputs("pwdfile_verify: ", stderr);
+	vfprintf(stderr, fmt, ap);
+	fputc('\n', stderr);
+}
+
+static int ask_daemon(const char *path, struct pwdfile_pair *pairs, size_t n) {
+	struct pwdproto_response response;
+	size_t sent = 0, received = 0;
+	int fd;
+
+	if ((fd = pwdproto_connect(path, geteuid())) == -1)
+		return -1;
+	while (received < n) {
+		if (sent < n && sent - received < WINDOW) {
+			if (pwdproto_send(fd, sent, PWDPROTO_VERIFY, pairs[sent].user, pairs[sent].password) == -1)
+				return -1;
+			++sent;
+			continue;
+		}
+		if (pwdproto_recv(fd, &response, TIMEOUT) == -1)
+			return -1;
+		if (response.id >= sent) {
+			errno = EPROTO;
+			return -1;
+		}
+		pairs[response.id].result = response.result;
+		++received;
+	}
+	close(fd);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	struct pwdfile_options *opts;
+	struct pwdfile_pair *pairs = NULL;
+	size_t n = 0, alloc = 0, i;
+	char *line = NULL;
+	size_t linelen;
+	ssize_t len;
+	const char *daemon_socket = NULL;
+	int legacy = 0;
+
+	if (argc > 2 && !strcmp(argv[1], "-s")) {
+		daemon_socket = argv[2];
+		argc -= 2;
+		argv += 2;
+	} else if (argc > 1 && !strcmp(argv[1], "-l")) {
+		legacy = 1;
+		--argc;
+		++argv;
+	}
+	if (argc < 2 && !daemon_socket) {
+		fprintf(stderr, "usage: pwdfile_verify [-l] <pwdfile> [<module option>...] < user:password lines\n"
+			"       pwdfile_verify -s <socket> < user:password lines\n");
+		return 2;
+	}
+
+	while ((len = getline(&line, &linelen, stdin)) > 0) {
+		char *colon;
+
+		if (line[len - 1] == '\n')
+			line[len - 1] = '\0';
+		if (!(colon = strchr(line, ':')))
+			continue;
+		if (n == alloc && !(pairs = realloc(pairs, (alloc = alloc ? 2 * alloc : 1024) * sizeof(*pairs)))) {
+			perror("pwdfile_verify");
+			return 1;
+		}
+		*colon = '\0';
+		pairs[n].user = line;
+		pairs[n].password = colon + 1;
+		++n;
+		line = NULL;
+	}
+
+	if (daemon_socket) {
+		if (ask_daemon(daemon_socket, pairs, n) == -1) {
+			fprintf(stderr, "pwdfile_verify: %s: %s\n", daemon_socket, strerror(errno));
+			return 1;
+		}
+	} else {
+		const char *args[] = { "pwdfile", argv[1], "legacy_crypt" };
+
+		if (!(opts = pwdfile_options_new())) {
+			perror("pwdfile_verify");
+			return 1;
+		}
+		pwdfile_options_set_log(opts, log_stderr, NULL);
+		pwdfile_options_parse(opts, legacy ? 3 : 2, args);
+		pwdfile_options_parse(opts, argc - 2, (const char **) argv + 2);
+		pwdfile_verify_batch(opts, pairs, n);
+		pwdfile_options_free(opts);
+	}
+
+	for (i = 0; i < n; i++)
+		printf("%s %s\n", pairs[i].user, results[pairs[i].result]);
+	return 0;
+}
@@ -0,0 +1,251 @@
+/*
+ * pwdfiled: check passwords for pam_pwdfile over a Unix socket, so the
+ * parsed pwdfile, authcache, statistics and crypt() workers live in one
+ * long running process instead of in every short-lived one that uses PAM.
+ *
+ * usage: pwdfiled [-m <mode>] <socket> [<module option>...]
+ * The options are those of the module, e.g. pwdfile=; watch is always on,
+ * so pwdfile is parsed once and again after each change. The socket is
+ * created with mode 0600 unless -m says otherwise: whoever can connect
+ * can try passwords. Each connection has a thread reading its requests,
+ * lookups are answered right away, verifications go to the worker pool
+ * of pwdfile_verify_async, one thread per CPU, and are answered when
+ * they are done. Runs in the foreground and logs to syslog.
+ *
+ * This file may be distributed under the same terms as pam_pwdfile.c.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "pwdfile.h"
+#include "pwdproto.h"
+
+struct conn {
+	int fd;
+	pthread_mutex_t lock;	/* of writes and refs */
+	unsigned refs;		/* the reader and each verification in flight */
+};
+
+struct pending {
+	struct conn *conn;
+	uint32_t id;
+};
+
+static struct pwdfile_options *opts;
+
+static void release(struct conn *conn) {
+	unsigned refs;
+
+	pthread_mutex_lock(&conn->lock);
+	refs = --conn->refs;
+	pthread_mutex_unlock(&conn->lock);
+	if (refs)
+		return;
+	close(conn->fd);
+	pthread_mutex_destroy(&conn->lock);
+	free(conn);
+}
+
+/*
+ * a client that went away just doesn't get it; one that doesn't read its
+ * answers is dropped instead of waited for, since this runs on the shared
+ * worker threads: a full socket buffer must not hold up everybody else
+ */
+static void respond(struct conn *conn, const struct pwdproto_response *response) {
+	const char *p = (const char *) response;
+	size_t left = sizeof(*response);
+	ssize_t n;
+
+	pthread_mutex_lock(&conn->lock);
+	while (left && ((n = send(conn->fd, p, left, MSG_NOSIGNAL | MSG_DONTWAIT)) > 0 || errno == EINTR))
+		if (n > 0) {
+			p += n;
+			left -= n;
+		}
+	/* ends the reader too, later answers fail right away */
+	if (left)
+		shutdown(conn->fd, SHUT_RDWR);
+	pthread_mutex_unlock(&conn->lock);
+}
+
+static void lookup(struct conn *conn, uint32_t id, const char *user) {
+	struct pwdproto_response response = { .id = id };
+	const char *crypted;
+	char *line;
+
+	response.result = pwdfile_lookup(opts, user, &line);
+	if (response.result == PWDFILE_OK) {
+		response.empty = !pwdfile_crypted(line, &crypted);
+		response.account = pwdfile_account(opts, line);
+		free(line);
+	}
+	respond(conn, &response);
+}
+
+static void verified(enum pwdfile_result result, void *arg) {
+	struct pending *pending = arg;
+	struct pwdproto_response response = { .id = pending->id, .result = result };
+
+	respond(pending->conn, &response);
+	release(pending->conn);
+	free(pending);
+}
+
+static void verify(struct conn *conn, uint32_t id, const char *user, const char *password) {
+	struct pwdproto_response response = { .id = id, .result = PWDFILE_ERROR };
+	struct pending *pending;
+
+	if (!(pending = malloc(sizeof(*pending)))) {
+		respond(conn, &response);
+		return;
+	}
+	pending->conn = conn;
+	pending->id = id;
+	pthread_mutex_lock(&conn->lock);
+	++conn->refs;
+	pthread_mutex_unlock(&conn->lock);
+	if (pwdfile_verify_async(opts, user, password, verified, pending) == -1) {
+		/* the queue is full */
+		response.result = PWDFILE_UNAVAIL;
+		respond(conn, &response);
+		release(conn);
+		free(pending);
+	}
+}
+
+static void *reader(void *arg) {
+	struct conn *conn = arg;
+	struct pwdproto_request request;
+	char user[PWDPROTO_FIELD_MAX + 1], password[PWDPROTO_FIELD_MAX + 1];
+
+	while (!pwdproto_read(conn->fd, &request, sizeof(request))) {
+		if (request.user_len > PWDPROTO_FIELD_MAX || request.password_len > PWDPROTO_FIELD_MAX)
+			break;
+		if (pwdproto_read(conn->fd, user, request.user_len)
+		    || pwdproto_read(conn->fd, password, request.password_len))
+			break;
+		user[request.user_len] = '\0';
+		password[request.password_len] = '\0';
+		if (request.op == PWDPROTO_LOOKUP)
+			lookup(conn, request.id, user);
+		else if (request.op == PWDPROTO_VERIFY)
+			verify(conn, request.id, user, password);
+		else
+			break;
+	}
+	explicit_bzero(password, sizeof(password));
+	/* answers still to come can be sent, but nothing more is read */
+	shutdown(conn->fd, SHUT_RD);
+	release(conn);
+	return NULL;
+}
+
+static int listen_on(const char *path, mode_t mode) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct stat st;
+	mode_t old;
+	int fd, err;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+	/* left behind by an earlier run, unless that still runs */
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+			return -1;
+		err = connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ? errno : 0;
+		close(fd);
+		if (!err) {
+			errno = EADDRINUSE;
+			return -1;
+		}
+		if (err == ECONNREFUSED)
+			unlink(path);
+	}
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+		return -1;
+	/* not connectable before its mode is right */
+	old = umask(0077);
+	err = bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+	umask(old);
+	if (err == -1 || chmod(path, mode) == -1 || listen(fd, SOMAXCONN) == -1) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int main(int argc, char **argv) {
+	pthread_attr_t attr;
+	pthread_t thread;
+	struct conn *conn;
+	mode_t mode = 0600;
+	char *line;
+	int opt, fd, cfd;
+
+	while ((opt = getopt(argc, argv, "m:")) != -1) {
+		if (opt == 'm')
+			mode = strtoul(optarg, NULL, 8) & 0777;
+		else
+			goto usage;
+	}
+	if (optind >= argc)
+		goto usage;
+
+	openlog("pwdfiled", LOG_PID, LOG_AUTHPRIV);
+	signal(SIGPIPE, SIG_IGN);
+	if (!(opts = pwdfile_options_new())) {
+		perror("pwdfiled");
+		return 1;
+	}
+	pwdfile_options_parse(opts, argc - optind - 1, (const char **) argv + optind + 1);
+	pwdfile_options_parse(opts, 1, (const char *[]) { "watch" });
+	/* parse pwdfile now, not on the first login */
+	if (pwdfile_lookup(opts, "", &line) == PWDFILE_OK)
+		free(line);
+
+	if ((fd = listen_on(argv[optind], mode)) == -1) {
+		fprintf(stderr, "pwdfiled: %s: %s\n", argv[optind], strerror(errno));
+		return 1;
+	}
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	for (;;) {
+		if ((cfd = accept4(fd, NULL, NULL, SOCK_CLOEXEC)) == -1) {
+			if (errno != EINTR && errno != ECONNABORTED) {
+				syslog(LOG_ERR, "accept: %m");
+				/* e.g. out of file descriptors, wait for some to be closed */
+				sleep(1);
+			}
+			continue;
+		}
+		if (!(conn = calloc(1, sizeof(*conn)))) {
+			close(cfd);
+			continue;
+		}
+		conn->fd = cfd;
+		conn->refs = 1;
+		pthread_mutex_init(&conn->lock, NULL);
+		if ((errno = pthread_create(&thread, &attr, reader, conn))) {
+			syslog(LOG_ERR, "pthread_create: %m");
+			release(conn);
+		}
+	}
+
+usage:
+	fprintf(stderr, "usage: pwdfiled [-m <mode>] <socket> [<module option>...]\n");
+	return 2;
+}
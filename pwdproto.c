@@ -0,0 +1,148 @@
+/*
+ * Both ends of the pwdfiled protocol, see pwdproto.h.
+ * Clients run inside any program that uses PAM, so nothing here may
+ * raise SIGPIPE.
+ *
+ * This file may be distributed under the same terms as pam_pwdfile.c.
+ */
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "pwdfile.h"
+#include "pwdproto.h"
+
+int pwdproto_connect(const char *path, uid_t uid) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct ucred peer;
+	socklen_t len = sizeof(peer);
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+		return -1;
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+		goto failed;
+	/* whoever could bind path could answer anything */
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &len) == -1)
+		goto failed;
+	if (peer.uid != 0 && peer.uid != uid) {
+		errno = EPERM;
+		goto failed;
+	}
+	return fd;
+
+failed:
+	close(fd);
+	return -1;
+}
+
+int pwdproto_send(int fd, uint32_t id, enum pwdproto_op op, const char *user, const char *password) {
+	struct pwdproto_request request = {
+		.id = id,
+		.op = op,
+		.user_len = strlen(user),
+		.password_len = strlen(password),
+	};
+	struct iovec iov[3] = {
+		{ &request, sizeof(request) },
+		{ (void *) user, request.user_len },
+		{ (void *) password, request.password_len },
+	};
+	struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 3 };
+	ssize_t n;
+	int i;
+
+	if (strlen(user) > PWDPROTO_FIELD_MAX || strlen(password) > PWDPROTO_FIELD_MAX) {
+		errno = E2BIG;
+		return -1;
+	}
+	for (i = 0; i < 3;) {
+		if ((n = sendmsg(fd, &msg, MSG_NOSIGNAL)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		/* skip what was sent */
+		for (; i < 3 && (size_t) n >= iov[i].iov_len; i++)
+			n -= iov[i].iov_len;
+		if (i < 3) {
+			iov[i].iov_base = (char *) iov[i].iov_base + n;
+			iov[i].iov_len -= n;
+			msg.msg_iov = iov + i;
+			msg.msg_iovlen = 3 - i;
+		}
+	}
+	return 0;
+}
+
+int pwdproto_recv(int fd, struct pwdproto_response *response, int timeout_ms) {
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	char *p = (char *) response;
+	size_t got = 0;
+	ssize_t n;
+	int ready;
+
+	while (got < sizeof(*response)) {
+		if ((ready = poll(&pfd, 1, timeout_ms)) == -1 && errno != EINTR)
+			return -1;
+		if (ready == 0) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		if (ready == -1)
+			continue;
+		if ((n = recv(fd, p + got, sizeof(*response) - got, 0)) == -1 && errno != EINTR)
+			return -1;
+		if (n == 0) {
+			errno = ECONNRESET;
+			return -1;
+		}
+		if (n > 0)
+			got += n;
+	}
+	/* don't trust a result the library doesn't know */
+	if (response->result > PWDFILE_ERROR)
+		response->result = PWDFILE_ERROR;
+	return 0;
+}
+
+int pwdproto_ask(int fd, enum pwdproto_op op, const char *user, const char *password,
+		 struct pwdproto_response *response, int timeout_ms) {
+	static uint32_t next_id;
+	uint32_t id = __atomic_add_fetch(&next_id, 1, __ATOMIC_RELAXED);
+
+	if (pwdproto_send(fd, id, op, user, password) == -1 || pwdproto_recv(fd, response, timeout_ms) == -1)
+		return -1;
+	if (response->id != id) {
+		errno = EPROTO;
+		return -1;
+	}
+	return 0;
+}
+
+int pwdproto_read(int fd, void *buf, size_t len) {
+	char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		if ((n = read(fd, p, len)) == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
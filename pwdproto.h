@@ -0,0 +1,51 @@
+#ifndef PWDPROTO_H
+#define PWDPROTO_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * The protocol between pwdfiled and pam_pwdfile on a local stream socket.
+ * A client sends requests, each a struct pwdproto_request followed by
+ * user and password, without waiting for the answers to earlier ones.
+ * Each answer is a struct pwdproto_response with the id of its request,
+ * sent when it is done, so answers may come in another order.
+ * Integers are in host byte order, both ends are on the same host.
+ */
+
+#define PWDPROTO_FIELD_MAX	1024	/* bytes of user or password */
+
+enum pwdproto_op {
+	PWDPROTO_LOOKUP = 1,	/* result, empty and account of user */
+	PWDPROTO_VERIFY = 2,	/* result of pwdfile_verify */
+};
+
+struct pwdproto_request {
+	uint32_t id;
+	uint8_t op;
+	uint8_t pad;
+	uint16_t user_len;
+	uint16_t password_len;
+	uint16_t pad2;
+};
+
+struct pwdproto_response {
+	uint32_t id;
+	uint8_t result;		/* enum pwdfile_result */
+	uint8_t account;	/* enum pwdfile_account, for PWDPROTO_LOOKUP */
+	uint8_t empty;		/* the crypt field is empty, for PWDPROTO_LOOKUP */
+	uint8_t pad;
+};
+
+/* -1 with errno EPERM if the daemon isn't run by root or uid */
+int pwdproto_connect(const char *path, uid_t uid);
+int pwdproto_send(int fd, uint32_t id, enum pwdproto_op op, const char *user, const char *password);
+/* -1 with errno ETIMEDOUT when the response didn't arrive in time */
+int pwdproto_recv(int fd, struct pwdproto_response *response, int timeout_ms);
+/* send one request and wait for its response */
+int pwdproto_ask(int fd, enum pwdproto_op op, const char *user, const char *password,
+		 struct pwdproto_response *response, int timeout_ms);
+/* for the daemon: 0 once len bytes are read, -1 on error or end of file */
+int pwdproto_read(int fd, void *buf, size_t len);
+
+#endif				/* PWDPROTO_H */
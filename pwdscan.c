@@ -0,0 +1,158 @@
+/*
+ * Find a user's line in a password file that is mapped into memory,
+ * without copying or modifying it.
+ *
+ * Only lines starting with the first character of the username are
+ * candidates, so the search looks for '\n' followed by that character.
+ * On x86 this is done 16 (SSE2) or 32 (AVX2) bytes at a time.
+ * A file sorted by username can be searched by halving instead.
+ *
+ * This file may be distributed under the same terms as pam_pwdfile.c.
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <string.h>
+
+#include "pwdscan.h"
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define PWDSCAN_X86
+#include <immintrin.h>
+#endif
+
+typedef const char *(*find_fn)(const char *p, const char *end, char c);
+
+/* first '\n' in [p, end) that is followed by c */
+static const char *find_nl_c_scalar(const char *p, const char *end, char c) {
+	while ((p = memchr(p, '\n', end - p)) && p + 1 < end) {
+		if (p[1] == c)
+			return p;
+		++p;
+	}
+	return NULL;
+}
+
+#ifdef PWDSCAN_X86
+static const char *find_nl_c_sse2(const char *p, const char *end, char c) {
+	const __m128i nl = _mm_set1_epi8('\n'), first = _mm_set1_epi8(c);
+
+	for (; end - p > 16; p += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *) p);
+		__m128i b = _mm_loadu_si128((const __m128i *) (p + 1));
+		unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, nl), _mm_cmpeq_epi8(b, first)));
+		if (mask)
+			return p + __builtin_ctz(mask);
+	}
+	return find_nl_c_scalar(p, end, c);
+}
+
+__attribute__((target("avx2")))
+static const char *find_nl_c_avx2(const char *p, const char *end, char c) {
+	const __m256i nl = _mm256_set1_epi8('\n'), first = _mm256_set1_epi8(c);
+
+	for (; end - p > 32; p += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i *) p);
+		__m256i b = _mm256_loadu_si256((const __m256i *) (p + 1));
+		uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, nl), _mm256_cmpeq_epi8(b, first)));
+		if (mask)
+			return p + __builtin_ctz(mask);
+	}
+	return find_nl_c_sse2(p, end, c);
+}
+#endif
+
+static find_fn choose_find(void) {
+#ifdef PWDSCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return find_nl_c_avx2;
+	return find_nl_c_sse2;
+#else
+	return find_nl_c_scalar;
+#endif
+}
+
+const char *pwdscan_find(const char *buf, size_t len, const char *name, size_t *linelen) {
+	static find_fn find;
+	size_t namelen = strlen(name);
+	const char *p = buf, *end = buf + len, *nl;
+	/* an empty username matches a line starting with the separator */
+	char c = namelen ? name[0] : ':';
+
+	if (!find)
+		find = choose_find();
+
+	for (;;) {
+		if ((size_t) (end - p) > namelen && !memcmp(p, name, namelen) && p[namelen] == ':') {
+			nl = memchr(p, '\n', end - p);
+			*linelen = (nl ? nl : end) - p;
+			return p;
+		}
+		if (!(p = find(p, end, c)))
+			return NULL;
+		++p;
+	}
+}
+
+/* the length of the username at p, the start of a line */
+static size_t key_len(const char *p, const char *end) {
+	const char *q = p;
+
+	while (q < end && *q != ':' && *q != '\n')
+		++q;
+	return q - p;
+}
+
+/* byte order, a username before any longer one it is the start of */
+static int key_cmp(const char *a, size_t alen, const char *b, size_t blen) {
+	int c = memcmp(a, b, alen < blen ? alen : blen);
+
+	return c ? c : (alen > blen) - (alen < blen);
+}
+
+int pwdscan_sorted(const char *buf, size_t len) {
+	const char *p = buf, *end = buf + len, *prev = NULL, *nl;
+	size_t keylen, prevlen = 0;
+
+	for (; p < end; p = nl + 1) {
+		keylen = key_len(p, end);
+		if (prev && key_cmp(prev, prevlen, p, keylen) > 0)
+			return 0;
+		prev = p;
+		prevlen = keylen;
+		if (!(nl = memchr(p + keylen, '\n', end - p - keylen)))
+			break;
+	}
+	return 1;
+}
+
+const char *pwdscan_bsearch(const char *buf, size_t len, const char *name, size_t *linelen) {
+	size_t namelen = strlen(name);
+	const char *lo = buf, *hi = buf + len, *end = buf + len, *mid, *p, *nl;
+
+	/* lines before lo have smaller usernames, lines from hi on don't; both are line starts */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		p = memrchr(lo, '\n', mid - lo);
+		p = p ? p + 1 : lo;
+		if (key_cmp(p, key_len(p, end), name, namelen) < 0) {
+			nl = memchr(p, '\n', end - p);
+			lo = nl ? nl + 1 : end;
+		} else
+			hi = p;
+	}
+
+	/* the first line of the user, like pwdscan_find, which skips lines without a password field */
+	while ((size_t) (end - lo) >= namelen && !memcmp(lo, name, namelen) && key_len(lo, end) == namelen) {
+		nl = memchr(lo, '\n', end - lo);
+		if (lo + namelen < end && lo[namelen] == ':') {
+			*linelen = (nl ? nl : end) - lo;
+			return lo;
+		}
+		if (!nl)
+			break;
+		lo = nl + 1;
+	}
+	return NULL;
+}
@@ -0,0 +1,12 @@
+#ifndef PWDSCAN_H
+#define PWDSCAN_H
+
+#include <stddef.h>
+
+/* the first line of name, which must not contain ':' or '\n' */
+const char *pwdscan_find(const char *buf, size_t len, const char *name, size_t *linelen);
+/* the same in O(log n) lines, if pwdscan_sorted: usernames in byte order like LC_ALL=C sort -t: -k1,1 */
+const char *pwdscan_bsearch(const char *buf, size_t len, const char *name, size_t *linelen);
+int pwdscan_sorted(const char *buf, size_t len);
+
+#endif				/* PWDSCAN_H */
@@ -0,0 +1,299 @@
+/*
+ * Build and query a parsed copy of a password file, see pwdtable.h.
+ *
+ * This file may be distributed under the same terms as pam_pwdfile.c.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/mman.h>
+
+#include "pwdtable.h"
+
+/* FNV-1a, stable across builds and byte orders */
+uint32_t pwdtable_hash(const char *name, size_t len) {
+	uint32_t h = 2166136261U;
+
+	while (len--) {
+		h ^= (unsigned char) *name++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+/*
+ * the shard of a user out of nshards, from the high bits of the hash:
+ * the low ones pick the slot in a table of the shard. FNV-1a mixes the
+ * last bytes badly into the high bits, so they get mixed again first.
+ */
+unsigned pwdtable_shard(const char *name, size_t len, unsigned nshards) {
+	uint32_t h = pwdtable_hash(name, len);
+
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	h ^= h >> 16;
+	return ((uint64_t) h * nshards) >> 32;
+}
+
+/* read the whole file, the result is NUL-terminated */
+static char *read_all(int fd, size_t hint, size_t *len) {
+	size_t alloc = hint + 1, used = 0;
+	char *buf = malloc(alloc);
+	ssize_t n;
+
+	if (!buf)
+		return NULL;
+	for (;;) {
+		if (used + 1 == alloc) {
+			char *nbuf = realloc(buf, alloc *= 2);
+			if (!nbuf)
+				goto failed;
+			buf = nbuf;
+		}
+		n = read(fd, buf + used, alloc - used - 1);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			goto failed;
+		if (n == 0)
+			break;
+		used += n;
+	}
+	buf[used] = '\0';
+	*len = used;
+	return buf;
+
+failed:
+	free(buf);
+	return NULL;
+}
+
+struct pwdtable *pwdtable_build(int fd) {
+	struct stat st;
+	struct pwdtable *table;
+	char *data, *line, *end, *arena;
+	size_t len, nlines = 0, nslots, arena_off, total;
+
+	if (fstat(fd, &st) == -1)
+		return NULL;
+	if (!(data = read_all(fd, st.st_size, &len)))
+		return NULL;
+
+	for (line = data; (line = memchr(line, '\n', data + len - line)); ++line)
+		++nlines;
+	++nlines;	/* last line without newline */
+
+	for (nslots = 16; nslots < 2 * nlines; nslots *= 2)
+		;
+	arena_off = sizeof(*table) + nslots * sizeof(struct pwdtable_slot);
+	total = arena_off + len + 1;
+	if (total > UINT32_MAX || !(table = calloc(1, total))) {
+		free(data);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	table->magic = PWDTABLE_MAGIC;
+	table->version = PWDTABLE_VERSION;
+	table->size = total;
+	table->nslots = nslots;
+	table->src_dev = st.st_dev;
+	table->src_ino = st.st_ino;
+	table->src_size = st.st_size;
+	table->src_mtime_sec = st.st_mtim.tv_sec;
+	table->src_mtime_nsec = st.st_mtim.tv_nsec;
+
+	arena = (char *) table + arena_off;
+	memcpy(arena, data, len + 1);
+	free(data);
+
+	for (line = arena; line < arena + len; line = end + 1) {
+		char *colon;
+		uint32_t h, i;
+
+		if (!(end = memchr(line, '\n', arena + len - line)))
+			end = arena + len;
+		*end = '\0';
+
+		/* lines without a password field never match */
+		if (!(colon = memchr(line, ':', end - line)))
+			continue;
+
+		h = pwdtable_hash(line, colon - line);
+		for (i = h & (nslots - 1); table->slots[i].offset; i = (i + 1) & (nslots - 1)) {
+			const char *other = (char *) table + table->slots[i].offset;
+			/* first entry wins, like in a linear scan */
+			if (table->slots[i].hash == h && !strncmp(other, line, colon - line + 1))
+				break;
+		}
+		if (table->slots[i].offset)
+			continue;
+		table->slots[i].hash = h;
+		table->slots[i].offset = line - (char *) table;
+		++table->nentries;
+	}
+
+	return table;
+}
+
+/* the slot of name, NULL if there is none */
+static const struct pwdtable_slot *find_slot(const struct pwdtable *table, const char *name) {
+	size_t len = strlen(name);
+	uint32_t h = pwdtable_hash(name, len);
+	uint32_t mask = table->nslots - 1, i;
+
+	for (i = h & mask; table->slots[i].offset; i = (i + 1) & mask) {
+		const char *line = (const char *) table + table->slots[i].offset;
+		if (table->slots[i].offset >= table->size)
+			return NULL;
+		if (table->slots[i].hash == h && !strncmp(line, name, len) && line[len] == ':')
+			return &table->slots[i];
+	}
+	return NULL;
+}
+
+const char *pwdtable_lookup(const struct pwdtable *table, const char *name) {
+	const struct pwdtable_slot *slot = find_slot(table, name);
+
+	return slot ? (const char *) table + slot->offset : NULL;
+}
+
+/*
+ * a malloc()ed copy of table for a password file in which only the line
+ * of name changed, to line, and that is now st; without parsing it again.
+ * A line that fits replaces the old one, a longer one is appended and
+ * the old one left unused. NULL with ENOENT if name isn't in table, with
+ * EFBIG once half of it would be unused: then it is time to build it again.
+ */
+struct pwdtable *pwdtable_patch(const struct pwdtable *table, const char *name, const char *line,
+				const struct stat *st) {
+	size_t len = strlen(line), old_len, size = table->size;
+	const struct pwdtable_slot *slot;
+	struct pwdtable *copy;
+	uint64_t dead = table->dead;
+	uint32_t offset;
+
+	if (!(slot = find_slot(table, name))) {
+		errno = ENOENT;
+		return NULL;
+	}
+	offset = slot->offset;
+	old_len = strlen((const char *) table + offset);
+	if (len > old_len) {
+		offset = size;
+		size += len + 1;
+		dead += old_len + 1;
+	} else
+		dead += old_len - len;
+	if (dead > size / 2) {
+		errno = EFBIG;
+		return NULL;
+	}
+	if (size > UINT32_MAX || !(copy = malloc(size))) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memcpy(copy, table, table->size);
+	memcpy((char *) copy + offset, line, len + 1);
+	copy->slots[slot - table->slots].offset = offset;
+	copy->size = size;
+	copy->dead = dead;
+	copy->src_dev = st->st_dev;
+	copy->src_ino = st->st_ino;
+	copy->src_size = st->st_size;
+	copy->src_mtime_sec = st->st_mtim.tv_sec;
+	copy->src_mtime_nsec = st->st_mtim.tv_nsec;
+	return copy;
+}
+
+int pwdtable_matches(const struct pwdtable *table, const struct stat *st) {
+	return table->src_dev == (uint64_t) st->st_dev
+		&& table->src_ino == (uint64_t) st->st_ino
+		&& table->src_size == (uint64_t) st->st_size
+		&& table->src_mtime_sec == st->st_mtim.tv_sec
+		&& table->src_mtime_nsec == st->st_mtim.tv_nsec;
+}
+
+/*
+ * write the table to a temporary file next to path and move it into place;
+ * with the owner and mode of like, the password file, if possible, but not writable
+ * by group or others, the module doesn't trust such a table; or else 0600,
+ * the table holds every hash
+ */
+int pwdtable_write(const struct pwdtable *table, const char *path, const struct stat *like) {
+	char *tmp;
+	const char *p = (const char *) table;
+	size_t left = table->size;
+	int fd;
+
+	if (asprintf(&tmp, "%s.XXXXXX", path) == -1)
+		return -1;
+	if ((fd = mkstemp(tmp)) == -1) {
+		free(tmp);
+		return -1;
+	}
+	while (left) {
+		ssize_t n = write(fd, p, left);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			goto failed;
+		p += n;
+		left -= n;
+	}
+	if (like && fchown(fd, like->st_uid, like->st_gid) == -1 && errno != EPERM)
+		goto failed;
+	if (fchmod(fd, like ? like->st_mode & 0644 : 0600) == -1 || fsync(fd) == -1)
+		goto failed;
+	if (close(fd) == -1) {
+		fd = -1;
+		goto failed;
+	}
+	fd = -1;
+	if (rename(tmp, path) == -1)
+		goto failed;
+	free(tmp);
+	return 0;
+
+failed:
+	if (fd != -1)
+		close(fd);
+	unlink(tmp);
+	free(tmp);
+	return -1;
+}
+
+/* map a table written by pwdtable_write, NULL if it is not a valid one */
+const struct pwdtable *pwdtable_map(int fd) {
+	struct stat st;
+	struct pwdtable *table;
+
+	if (fstat(fd, &st) == -1)
+		return NULL;
+	if ((size_t) st.st_size < sizeof(*table)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if ((table = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+		return NULL;
+	if (table->magic != PWDTABLE_MAGIC || table->version != PWDTABLE_VERSION
+	    || table->size != (uint64_t) st.st_size
+	    || !table->nslots || (table->nslots & (table->nslots - 1))
+	    || sizeof(*table) + (uint64_t) table->nslots * sizeof(struct pwdtable_slot) >= table->size
+	    || ((const char *) table)[table->size - 1]) {
+		munmap(table, st.st_size);
+		errno = EINVAL;
+		return NULL;
+	}
+	return table;
+}
+
+void pwdtable_unmap(const struct pwdtable *table) {
+	munmap((void *) table, table->size);
+}
@@ -0,0 +1,49 @@
+#ifndef PWDTABLE_H
+#define PWDTABLE_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+/*
+ * A password file parsed into one memory block: a header, an open-addressed
+ * hash table of slots and a string arena holding each user's line as a
+ * NUL-terminated "user:crypt:other:fields" string.
+ * Only offsets relative to the start of the block are stored.
+ */
+
+#define PWDTABLE_MAGIC		0x70776474U	/* "pwdt" */
+#define PWDTABLE_VERSION	2
+
+struct pwdtable_slot {
+	uint32_t hash;
+	uint32_t offset;	/* of the line, 0 for an empty slot */
+};
+
+struct pwdtable {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size;		/* of the whole block */
+	uint32_t nslots;	/* power of two */
+	uint32_t nentries;
+	uint64_t dead;		/* bytes of lines that pwdtable_patch replaced */
+	/* identity of the password file the table was built from */
+	uint64_t src_dev;
+	uint64_t src_ino;
+	uint64_t src_size;
+	int64_t src_mtime_sec;
+	int64_t src_mtime_nsec;
+	struct pwdtable_slot slots[];
+};
+
+uint32_t pwdtable_hash(const char *name, size_t len);
+unsigned pwdtable_shard(const char *name, size_t len, unsigned nshards);
+struct pwdtable *pwdtable_build(int fd);
+const char *pwdtable_lookup(const struct pwdtable *table, const char *name);
+struct pwdtable *pwdtable_patch(const struct pwdtable *table, const char *name, const char *line,
+				const struct stat *st);
+int pwdtable_matches(const struct pwdtable *table, const struct stat *st);
+int pwdtable_write(const struct pwdtable *table, const char *path, const struct stat *like);
+const struct pwdtable *pwdtable_map(int fd);
+void pwdtable_unmap(const struct pwdtable *table);
+
+#endif				/* PWDTABLE_H */
@@ -0,0 +1,157 @@
+/*
+ * Tell the hashing scheme of a crypt string, for tracing and statistics,
+ * and the memory a check of it needs.
+ *
+ * This file may be distributed under the same terms as pam_pwdfile.c.
+ */
+
+#include <string.h>
+
+#include "scheme.h"
+
+const char *const scheme_names[SCHEME_COUNT] = {
+	[SCHEME_EMPTY] = "empty",
+	[SCHEME_DES] = "des",
+	[SCHEME_BIGCRYPT] = "bigcrypt",
+	[SCHEME_BSDI] = "bsdicrypt",
+	[SCHEME_MD5] = "md5",
+	[SCHEME_BCRYPT] = "bcrypt",
+	[SCHEME_SHA256] = "sha256",
+	[SCHEME_SHA512] = "sha512",
+	[SCHEME_SCRYPT] = "scrypt",
+	[SCHEME_YESCRYPT] = "yescrypt",
+	[SCHEME_GOST_YESCRYPT] = "gost-yescrypt",
+	[SCHEME_OTHER] = "other",
+};
+
+static const char itoa64[] =
+	"./0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+static const struct {
+	const char *prefix;
+	enum scheme scheme;
+} prefixes[] = {
+	{ "$1$", SCHEME_MD5 },
+	{ "$2b$", SCHEME_BCRYPT },
+	{ "$2a$", SCHEME_BCRYPT },
+	{ "$2x$", SCHEME_BCRYPT },
+	{ "$2y$", SCHEME_BCRYPT },
+	{ "$5$", SCHEME_SHA256 },
+	{ "$6$", SCHEME_SHA512 },
+	{ "$7$", SCHEME_SCRYPT },
+	{ "$y$", SCHEME_YESCRYPT },
+	{ "$gy$", SCHEME_GOST_YESCRYPT },
+	{ "_", SCHEME_BSDI },
+};
+
+enum scheme scheme_of(const char *crypted) {
+	size_t i, len;
+
+	if (!*crypted)
+		return SCHEME_EMPTY;
+	for (i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); i++)
+		if (!strncmp(crypted, prefixes[i].prefix, strlen(prefixes[i].prefix)))
+			return prefixes[i].scheme;
+	if (*crypted == '$')
+		return SCHEME_OTHER;
+
+	/* traditional DES has 2 salt and 11 hash characters, bigcrypt adds 11 per segment */
+	len = strlen(crypted);
+	if (strspn(crypted, itoa64) != len)
+		return SCHEME_OTHER;
+	if (len == 13)
+		return SCHEME_DES;
+	if (len > 13 && (len - 2) % 11 == 0)
+		return SCHEME_BIGCRYPT;
+	return SCHEME_OTHER;
+}
+
+enum scheme scheme_named(const char *name, size_t len) {
+	int i;
+
+	for (i = 0; i < SCHEME_COUNT; i++)
+		if (strlen(scheme_names[i]) == len && !strncmp(scheme_names[i], name, len))
+			return i;
+	return SCHEME_COUNT;
+}
+
+/* the first prefix of a scheme in prefixes is the one to write */
+const char *scheme_prefix(enum scheme scheme) {
+	size_t i;
+
+	for (i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); i++)
+		if (prefixes[i].scheme == scheme)
+			return prefixes[i].prefix;
+	return NULL;
+}
+
+static int atoi64(char c) {
+	const char *p = c ? strchr(itoa64, c) : NULL;
+
+	return p ? p - itoa64 : -1;
+}
+
+/* scrypt: fixed width, little endian */
+static const char *decode_fixed(const char *p, int chars, unsigned long long *value) {
+	int i, c;
+
+	for (*value = 0, i = 0; i < chars; i++) {
+		if ((c = atoi64(*p++)) < 0)
+			return NULL;
+		*value |= (unsigned long long) c << 6 * i;
+	}
+	return p;
+}
+
+/*
+ * yescrypt: the first character tells the number of characters, small
+ * values take one; like decode64_uint32 of yescrypt-common.c
+ */
+static const char *decode_variable(const char *p, unsigned long long min, unsigned long long *value) {
+	unsigned start = 0, end = 47, chars = 1, bits = 0;
+	int c;
+
+	if ((c = atoi64(*p++)) < 0)
+		return NULL;
+	*value = min;
+	while ((unsigned) c > end) {
+		*value += (unsigned long long) (end + 1 - start) << bits;
+		start = end + 1;
+		end = start + (62 - end) / 2;
+		chars++;
+		bits += 6;
+	}
+	*value += (unsigned long long) (c - start) << bits;
+	while (--chars) {
+		if ((c = atoi64(*p++)) < 0)
+			return NULL;
+		bits -= 6;
+		*value += (unsigned long long) c << bits;
+	}
+	return p;
+}
+
+/* both use 128 * r * N bytes, a parameter out of range counts as none */
+unsigned long long scheme_memory(const char *crypted) {
+	unsigned long long flavor, log_n, r;
+	const char *p;
+
+	switch (scheme_of(crypted)) {
+	case SCHEME_SCRYPT:
+		/* $7$, N as log2 in one character, r in five */
+		if ((log_n = atoi64(crypted[3])) < 1 || log_n > 40 || !decode_fixed(crypted + 4, 5, &r))
+			return 0;
+		break;
+	case SCHEME_YESCRYPT:
+	case SCHEME_GOST_YESCRYPT:
+		/* $y$ or $gy$, then flavor, log2 N and r */
+		p = strchr(crypted + 1, '$') + 1;
+		if (!(p = decode_variable(p, 0, &flavor)) || !(p = decode_variable(p, 1, &log_n))
+		    || !decode_variable(p, 1, &r) || log_n > 40)
+			return 0;
+		break;
+	default:
+		return 0;
+	}
+	return r > 1ULL << 20 ? 0 : 128 * r << log_n;
+}
@@ -0,0 +1,33 @@
+#ifndef SCHEME_H
+#define SCHEME_H
+
+#include <stddef.h>
+
+/* the hashing scheme of a crypt string, by its prefix */
+enum scheme {
+	SCHEME_EMPTY,
+	SCHEME_DES,
+	SCHEME_BIGCRYPT,
+	SCHEME_BSDI,
+	SCHEME_MD5,
+	SCHEME_BCRYPT,
+	SCHEME_SHA256,
+	SCHEME_SHA512,
+	SCHEME_SCRYPT,
+	SCHEME_YESCRYPT,
+	SCHEME_GOST_YESCRYPT,
+	SCHEME_OTHER,
+	SCHEME_COUNT
+};
+
+extern const char *const scheme_names[SCHEME_COUNT];
+
+enum scheme scheme_of(const char *crypted);
+/* SCHEME_COUNT for an unknown name */
+enum scheme scheme_named(const char *name, size_t len);
+/* the prefix new hashes of scheme start with, NULL if it has none */
+const char *scheme_prefix(enum scheme scheme);
+/* bytes a check of crypted needs for scrypt and yescrypt, 0 for the others */
+unsigned long long scheme_memory(const char *crypted);
+
+#endif				/* SCHEME_H */
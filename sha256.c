@@ -0,0 +1,178 @@
+/*
+ * SHA-256 as specified in FIPS 180-4, used with a random key as HMAC for
+ * the credential cache and by sha_crypt.c.
+ * The interface follows md5.c: Init, Update as often as needed, Final.
+ * On x86 CPUs with the SHA extensions a block takes the sha256rnds2
+ * instructions instead of the portable rounds.
+ *
+ * This file may be distributed under the same terms as pam_pwdfile.c.
+ */
+
+#include <string.h>
+
+#include "sha256.h"
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define SHA256_X86
+#include <immintrin.h>
+#endif
+
+typedef void (*transform_fn)(uint32_t state[8], const unsigned char block[64]);
+
+static const uint32_t K[64] = {
+	0x428a2f98U, 0x71374491U, 0xb5c0fbcfU, 0xe9b5dba5U, 0x3956c25bU, 0x59f111f1U, 0x923f82a4U, 0xab1c5ed5U,
+	0xd807aa98U, 0x12835b01U, 0x243185beU, 0x550c7dc3U, 0x72be5d74U, 0x80deb1feU, 0x9bdc06a7U, 0xc19bf174U,
+	0xe49b69c1U, 0xefbe4786U, 0x0fc19dc6U, 0x240ca1ccU, 0x2de92c6fU, 0x4a7484aaU, 0x5cb0a9dcU, 0x76f988daU,
+	0x983e5152U, 0xa831c66dU, 0xb00327c8U, 0xbf597fc7U, 0xc6e00bf3U, 0xd5a79147U, 0x06ca6351U, 0x14292967U,
+	0x27b70a85U, 0x2e1b2138U, 0x4d2c6dfcU, 0x53380d13U, 0x650a7354U, 0x766a0abbU, 0x81c2c92eU, 0x92722c85U,
+	0xa2bfe8a1U, 0xa81a664bU, 0xc24b8b70U, 0xc76c51a3U, 0xd192e819U, 0xd6990624U, 0xf40e3585U, 0x106aa070U,
+	0x19a4c116U, 0x1e376c08U, 0x2748774cU, 0x34b0bcb5U, 0x391c0cb3U, 0x4ed8aa4aU, 0x5b9cca4fU, 0x682e6ff3U,
+	0x748f82eeU, 0x78a5636fU, 0x84c87814U, 0x8cc70208U, 0x90befffaU, 0xa4506cebU, 0xbef9a3f7U, 0xc67178f2U,
+};
+
+#define ROR(x, n)	((x) >> (n) | (x) << (32 - (n)))
+#define CH(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+#define MAJ(x, y, z)	(((x) & (y)) | ((z) & ((x) | (y))))
+#define S0(x)		(ROR(x, 2) ^ ROR(x, 13) ^ ROR(x, 22))
+#define S1(x)		(ROR(x, 6) ^ ROR(x, 11) ^ ROR(x, 25))
+#define s0(x)		(ROR(x, 7) ^ ROR(x, 18) ^ ((x) >> 3))
+#define s1(x)		(ROR(x, 17) ^ ROR(x, 19) ^ ((x) >> 10))
+
+static void SHA256TransformPortable(uint32_t state[8], const unsigned char block[64])
+{
+	uint32_t W[64], a, b, c, d, e, f, g, h, t1, t2;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		W[i] = (uint32_t) block[4 * i] << 24 | (uint32_t) block[4 * i + 1] << 16
+			| (uint32_t) block[4 * i + 2] << 8 | block[4 * i + 3];
+	for (; i < 64; i++)
+		W[i] = s1(W[i - 2]) + W[i - 7] + s0(W[i - 15]) + W[i - 16];
+
+	a = state[0]; b = state[1]; c = state[2]; d = state[3];
+	e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+	for (i = 0; i < 64; i++) {
+		t1 = h + S1(e) + CH(e, f, g) + K[i] + W[i];
+		t2 = S0(a) + MAJ(a, b, c);
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+
+	state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+	state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+#ifdef SHA256_X86
+/*
+ * The state is kept as ABEF and CDGH, each sha256rnds2 does two rounds,
+ * sha256msg1 and sha256msg2 extend the message four words at a time.
+ */
+__attribute__((target("sha,sse4.1")))
+static void SHA256TransformNI(uint32_t state[8], const unsigned char block[64])
+{
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i abef, cdgh, abef_save, cdgh_save, tmp, msg, m[4];
+	int i;
+
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &state[0]), 0xb1);	/* CDAB */
+	cdgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &state[4]), 0x1b);	/* EFGH */
+	abef = _mm_alignr_epi8(tmp, cdgh, 8);
+	cdgh = _mm_blend_epi16(cdgh, tmp, 0xf0);
+	abef_save = abef;
+	cdgh_save = cdgh;
+
+	for (i = 0; i < 4; i++)
+		m[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (block + 16 * i)), bswap);
+#pragma GCC unroll 16
+	for (i = 0; i < 16; i++) {
+		/* W[4i..4i+3] from W[4i-16..4i-1] */
+		if (i >= 4)
+			m[i & 3] = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(m[i & 3], m[(i + 1) & 3]),
+								     _mm_alignr_epi8(m[(i + 3) & 3], m[(i + 2) & 3], 4)),
+							m[(i + 3) & 3]);
+		msg = _mm_add_epi32(m[i & 3], _mm_loadu_si128((const __m128i *) &K[4 * i]));
+		cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+		abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(msg, 0x0e));
+	}
+
+	abef = _mm_add_epi32(abef, abef_save);
+	cdgh = _mm_add_epi32(cdgh, cdgh_save);
+	tmp = _mm_shuffle_epi32(abef, 0x1b);		/* FEBA */
+	cdgh = _mm_shuffle_epi32(cdgh, 0xb1);		/* DCHG */
+	_mm_storeu_si128((__m128i *) &state[0], _mm_blend_epi16(tmp, cdgh, 0xf0));
+	_mm_storeu_si128((__m128i *) &state[4], _mm_alignr_epi8(cdgh, tmp, 8));
+}
+#endif
+
+static transform_fn choose_transform(void)
+{
+#ifdef SHA256_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1"))
+		return SHA256TransformNI;
+#endif
+	return SHA256TransformPortable;
+}
+
+static transform_fn SHA256Transform;
+
+void SHA256Init(struct SHA256Context *ctx)
+{
+	if (!SHA256Transform)
+		SHA256Transform = choose_transform();
+	ctx->state[0] = 0x6a09e667U;
+	ctx->state[1] = 0xbb67ae85U;
+	ctx->state[2] = 0x3c6ef372U;
+	ctx->state[3] = 0xa54ff53aU;
+	ctx->state[4] = 0x510e527fU;
+	ctx->state[5] = 0x9b05688cU;
+	ctx->state[6] = 0x1f83d9abU;
+	ctx->state[7] = 0x5be0cd19U;
+	ctx->count = 0;
+}
+
+void SHA256Update(struct SHA256Context *ctx, const void *data, size_t len)
+{
+	const unsigned char *buf = data;
+	size_t t = ctx->count & 0x3f;	/* bytes already in ctx->in */
+
+	ctx->count += len;
+
+	if (t) {
+		size_t n = 64 - t;
+		if (len < n) {
+			memcpy(ctx->in + t, buf, len);
+			return;
+		}
+		memcpy(ctx->in + t, buf, n);
+		SHA256Transform(ctx->state, ctx->in);
+		buf += n;
+		len -= n;
+	}
+	for (; len >= 64; buf += 64, len -= 64)
+		SHA256Transform(ctx->state, buf);
+	memcpy(ctx->in, buf, len);
+}
+
+void SHA256Final(unsigned char digest[32], struct SHA256Context *ctx)
+{
+	size_t t = ctx->count & 0x3f;
+	uint64_t bits = ctx->count << 3;
+	int i;
+
+	ctx->in[t++] = 0x80;
+	if (t > 56) {
+		memset(ctx->in + t, 0, 64 - t);
+		SHA256Transform(ctx->state, ctx->in);
+		t = 0;
+	}
+	memset(ctx->in + t, 0, 56 - t);
+	for (i = 0; i < 8; i++)
+		ctx->in[56 + i] = bits >> (56 - 8 * i);
+	SHA256Transform(ctx->state, ctx->in);
+
+	for (i = 0; i < 32; i++)
+		digest[i] = ctx->state[i / 4] >> (24 - 8 * (i % 4));
+	memset(ctx, 0, sizeof(*ctx));	/* In case it's sensitive */
+}
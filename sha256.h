@@ -0,0 +1,17 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct SHA256Context {
+	uint32_t state[8];
+	uint64_t count;		/* bytes */
+	unsigned char in[64];
+};
+
+void SHA256Init(struct SHA256Context *);
+void SHA256Update(struct SHA256Context *, const void *, size_t);
+void SHA256Final(unsigned char digest[32], struct SHA256Context *);
+
+#endif				/* SHA256_H */
@@ -0,0 +1,199 @@
+/*
+ * SHA-512 as specified in FIPS 180-4, for sha_crypt.c.
+ * The interface follows sha256.c. On x86 CPUs with AVX2 the message
+ * schedule is computed four words at a time and the rounds use the
+ * BMI2 rotations.
+ *
+ * This file may be distributed under the same terms as pam_pwdfile.c.
+ */
+
+#include <string.h>
+#include <endian.h>
+
+#include "sha512.h"
+
+#if defined(__x86_64__)
+#define SHA512_X86
+#include <immintrin.h>
+#endif
+
+typedef void (*transform_fn)(uint64_t state[8], const unsigned char block[128]);
+
+static const uint64_t K[80] = {
+	0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+	0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+	0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+	0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+	0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+	0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+	0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+	0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+	0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+	0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+	0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+	0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+	0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+	0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+	0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+	0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+	0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+	0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+	0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+	0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL,
+};
+
+#define ROR(x, n)	((x) >> (n) | (x) << (64 - (n)))
+#define CH(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+#define MAJ(x, y, z)	(((x) & (y)) | ((z) & ((x) | (y))))
+#define S0(x)		(ROR(x, 28) ^ ROR(x, 34) ^ ROR(x, 39))
+#define S1(x)		(ROR(x, 14) ^ ROR(x, 18) ^ ROR(x, 41))
+#define s0(x)		(ROR(x, 1) ^ ROR(x, 8) ^ ((x) >> 7))
+#define s1(x)		(ROR(x, 19) ^ ROR(x, 61) ^ ((x) >> 6))
+
+/* inlined into each transform, so it is compiled for that one's target */
+static inline __attribute__((always_inline)) void rounds(uint64_t state[8], const uint64_t W[80])
+{
+	uint64_t a, b, c, d, e, f, g, h, t1, t2;
+	int i;
+
+	a = state[0]; b = state[1]; c = state[2]; d = state[3];
+	e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+	/* unrolled, so the variables rotate by renaming instead of moves */
+#pragma GCC unroll 80
+	for (i = 0; i < 80; i++) {
+		t1 = h + S1(e) + CH(e, f, g) + K[i] + W[i];
+		t2 = S0(a) + MAJ(a, b, c);
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+
+	state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+	state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+static void SHA512TransformPortable(uint64_t state[8], const unsigned char block[128])
+{
+	uint64_t W[80];
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		memcpy(&W[i], block + 8 * i, 8);
+		W[i] = be64toh(W[i]);
+	}
+	for (; i < 80; i++)
+		W[i] = s1(W[i - 2]) + W[i - 7] + s0(W[i - 15]) + W[i - 16];
+	rounds(state, W);
+}
+
+#ifdef SHA512_X86
+#define RORV(x, n)	_mm256_or_si256(_mm256_srli_epi64(x, n), _mm256_slli_epi64(x, 64 - (n)))
+#define RORV2(x, n)	_mm_or_si128(_mm_srli_epi64(x, n), _mm_slli_epi64(x, 64 - (n)))
+
+/*
+ * W[i..i+3] = s1(W[i-2..i+1]) + W[i-7..i-4] + s0(W[i-15..i-12]) + W[i-16..i-13]:
+ * all but the s1 terms of W[i+2] and W[i+3] are known beforehand, those
+ * are added once W[i] and W[i+1] are.
+ */
+__attribute__((target("avx2,bmi2")))
+static void SHA512TransformAVX2(uint64_t state[8], const unsigned char block[128])
+{
+	const __m256i bswap = _mm256_set_epi64x(0x08090a0b0c0d0e0fULL, 0x0001020304050607ULL,
+						0x08090a0b0c0d0e0fULL, 0x0001020304050607ULL);
+	uint64_t W[80] __attribute__((aligned(32)));
+	__m256i x, t;
+	__m128i lo;
+	int i;
+
+	for (i = 0; i < 16; i += 4)
+		_mm256_store_si256((__m256i *) &W[i],
+				   _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *) (block + 8 * i)), bswap));
+	for (; i < 80; i += 4) {
+		x = _mm256_loadu_si256((const __m256i *) &W[i - 15]);
+		t = _mm256_xor_si256(_mm256_xor_si256(RORV(x, 1), RORV(x, 8)), _mm256_srli_epi64(x, 7));
+		t = _mm256_add_epi64(t, _mm256_load_si256((const __m256i *) &W[i - 16]));
+		t = _mm256_add_epi64(t, _mm256_loadu_si256((const __m256i *) &W[i - 7]));
+		lo = _mm_loadu_si128((const __m128i *) &W[i - 2]);
+		lo = _mm_add_epi64(_mm256_castsi256_si128(t),
+				   _mm_xor_si128(_mm_xor_si128(RORV2(lo, 19), RORV2(lo, 61)), _mm_srli_epi64(lo, 6)));
+		_mm_store_si128((__m128i *) &W[i], lo);
+		lo = _mm_add_epi64(_mm256_extracti128_si256(t, 1),
+				   _mm_xor_si128(_mm_xor_si128(RORV2(lo, 19), RORV2(lo, 61)), _mm_srli_epi64(lo, 6)));
+		_mm_store_si128((__m128i *) &W[i + 2], lo);
+	}
+	rounds(state, W);
+}
+#endif
+
+static transform_fn choose_transform(void)
+{
+#ifdef SHA512_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2"))
+		return SHA512TransformAVX2;
+#endif
+	return SHA512TransformPortable;
+}
+
+static transform_fn SHA512Transform;
+
+void SHA512Init(struct SHA512Context *ctx)
+{
+	if (!SHA512Transform)
+		SHA512Transform = choose_transform();
+	ctx->state[0] = 0x6a09e667f3bcc908ULL;
+	ctx->state[1] = 0xbb67ae8584caa73bULL;
+	ctx->state[2] = 0x3c6ef372fe94f82bULL;
+	ctx->state[3] = 0xa54ff53a5f1d36f1ULL;
+	ctx->state[4] = 0x510e527fade682d1ULL;
+	ctx->state[5] = 0x9b05688c2b3e6c1fULL;
+	ctx->state[6] = 0x1f83d9abfb41bd6bULL;
+	ctx->state[7] = 0x5be0cd19137e2179ULL;
+	ctx->count = 0;
+}
+
+void SHA512Update(struct SHA512Context *ctx, const void *data, size_t len)
+{
+	const unsigned char *buf = data;
+	size_t t = ctx->count & 0x7f;	/* bytes already in ctx->in */
+
+	ctx->count += len;
+
+	if (t) {
+		size_t n = 128 - t;
+		if (len < n) {
+			memcpy(ctx->in + t, buf, len);
+			return;
+		}
+		memcpy(ctx->in + t, buf, n);
+		SHA512Transform(ctx->state, ctx->in);
+		buf += n;
+		len -= n;
+	}
+	for (; len >= 128; buf += 128, len -= 128)
+		SHA512Transform(ctx->state, buf);
+	memcpy(ctx->in, buf, len);
+}
+
+void SHA512Final(unsigned char digest[64], struct SHA512Context *ctx)
+{
+	size_t t = ctx->count & 0x7f;
+	uint64_t bits = ctx->count << 3;
+	int i;
+
+	ctx->in[t++] = 0x80;
+	if (t > 112) {
+		memset(ctx->in + t, 0, 128 - t);
+		SHA512Transform(ctx->state, ctx->in);
+		t = 0;
+	}
+	/* the upper half of the 128 bit length is 0 */
+	memset(ctx->in + t, 0, 120 - t);
+	for (i = 0; i < 8; i++)
+		ctx->in[120 + i] = bits >> (56 - 8 * i);
+	SHA512Transform(ctx->state, ctx->in);
+
+	for (i = 0; i < 64; i++)
+		digest[i] = ctx->state[i / 8] >> (56 - 8 * (i % 8));
+	memset(ctx, 0, sizeof(*ctx));	/* In case it's sensitive */
+}
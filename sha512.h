@@ -0,0 +1,17 @@
+#ifndef SHA512_H
+#define SHA512_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct SHA512Context {
+	uint64_t state[8];
+	uint64_t count;		/* bytes */
+	unsigned char in[128];
+};
+
+void SHA512Init(struct SHA512Context *);
+void SHA512Update(struct SHA512Context *, const void *, size_t);
+void SHA512Final(unsigned char digest[64], struct SHA512Context *);
+
+#endif				/* SHA512_H */
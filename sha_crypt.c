@@ -0,0 +1,187 @@
+/*
+ * SHA-crypt, the $5$ and $6$ schemes of glibc and libxcrypt, as described
+ * in Ulrich Drepper's "Unix crypt using SHA-256 and SHA-512".
+ * It gives the same strings as libcrypt, but a round costs one call of
+ * the block function of sha256.c or sha512.c, which use the CPU's SHA
+ * extensions or AVX2 when they are there.
+ *
+ * This file may be distributed under the same terms as pam_pwdfile.c.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sha256.h"
+#include "sha512.h"
+#include "sha_crypt.h"
+
+#define ROUNDS_DEFAULT	5000
+#define ROUNDS_MIN	1000
+#define ROUNDS_MAX	999999999
+#define SALT_MAX	16
+
+static const char itoa64[] =	/* 0 ... 63 => ascii - 64 */
+"./0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+/* the digest bytes encoded by each group of 4 characters, most significant first */
+static const unsigned char order256[][3] = {
+	{ 0, 10, 20 }, { 21, 1, 11 }, { 12, 22, 2 }, { 3, 13, 23 }, { 24, 4, 14 },
+	{ 15, 25, 5 }, { 6, 16, 26 }, { 27, 7, 17 }, { 18, 28, 8 }, { 9, 19, 29 },
+};
+
+static const unsigned char order512[][3] = {
+	{ 0, 21, 42 }, { 22, 43, 1 }, { 44, 2, 23 }, { 3, 24, 45 }, { 25, 46, 4 },
+	{ 47, 5, 26 }, { 6, 27, 48 }, { 28, 49, 7 }, { 50, 8, 29 }, { 9, 30, 51 },
+	{ 31, 52, 10 }, { 53, 11, 32 }, { 12, 33, 54 }, { 34, 55, 13 }, { 56, 14, 35 },
+	{ 15, 36, 57 }, { 37, 58, 16 }, { 59, 17, 38 }, { 18, 39, 60 }, { 40, 61, 19 },
+	{ 62, 20, 41 },
+};
+
+struct hash {
+	int sha512;
+	union {
+		struct SHA256Context sha256;
+		struct SHA512Context sha512;
+	} u;
+};
+
+static void init(struct hash *h)
+{
+	if (h->sha512)
+		SHA512Init(&h->u.sha512);
+	else
+		SHA256Init(&h->u.sha256);
+}
+
+static void update(struct hash *h, const void *data, size_t len)
+{
+	if (h->sha512)
+		SHA512Update(&h->u.sha512, data, len);
+	else
+		SHA256Update(&h->u.sha256, data, len);
+}
+
+static void final(struct hash *h, unsigned char *digest)
+{
+	if (h->sha512)
+		SHA512Final(digest, &h->u.sha512);
+	else
+		SHA256Final(digest, &h->u.sha256);
+}
+
+static char *to64(char *s, unsigned long v, int n)
+{
+	while (--n >= 0) {
+		*s++ = itoa64[v & 0x3f];
+		v >>= 6;
+	}
+	return s;
+}
+
+char *sha_crypt_r(const char *key, const char *salt, char *output)
+{
+	struct hash h;
+	unsigned char A[64], B[64], DP[64], DS[64], *P;
+	unsigned long rounds = ROUNDS_DEFAULT, r;
+	const char *s = salt;
+	char *end, *out;
+	size_t kl = strlen(key), sl, size, n, i;
+
+	if (!strncmp(s, "$5$", 3))
+		h.sha512 = 0;
+	else if (!strncmp(s, "$6$", 3))
+		h.sha512 = 1;
+	else
+		return NULL;
+	size = h.sha512 ? 64 : 32;
+	s += 3;
+	if (!strncmp(s, "rounds=", 7)) {
+		/* glibc clamps the rest, libxcrypt refuses it */
+		if (s[7] < '1' || s[7] > '9')
+			return NULL;
+		rounds = strtoul(s + 7, &end, 10);
+		if (*end != '$' || rounds < ROUNDS_MIN || rounds > ROUNDS_MAX)
+			return NULL;
+		s = end + 1;
+	}
+	sl = strspn(s, itoa64);
+	if (sl > SALT_MAX || (s[sl] && s[sl] != '$'))
+		return NULL;
+	if (!(P = malloc(kl ? kl : 1)))
+		return NULL;
+
+	/* B = H(key salt key) */
+	init(&h);
+	update(&h, key, kl);
+	update(&h, s, sl);
+	update(&h, key, kl);
+	final(&h, B);
+
+	/* A = H(key salt, B for every byte of key, then B or key for each bit of its length) */
+	init(&h);
+	update(&h, key, kl);
+	update(&h, s, sl);
+	for (n = kl; n > size; n -= size)
+		update(&h, B, size);
+	update(&h, B, n);
+	for (n = kl; n; n >>= 1)
+		if (n & 1)
+			update(&h, B, size);
+		else
+			update(&h, key, kl);
+	final(&h, A);
+
+	/* P: H(key repeated once per byte of key), as long as key */
+	init(&h);
+	for (i = 0; i < kl; i++)
+		update(&h, key, kl);
+	final(&h, DP);
+	for (i = 0; i < kl; i += size)
+		memcpy(P + i, DP, kl - i < size ? kl - i : size);
+
+	/* S: H(salt repeated 16 + A[0] times), as long as salt */
+	init(&h);
+	for (i = 0; i < 16 + (size_t) A[0]; i++)
+		update(&h, s, sl);
+	final(&h, DS);
+
+	for (r = 0; r < rounds; r++) {
+		init(&h);
+		if (r & 1)
+			update(&h, P, kl);
+		else
+			update(&h, A, size);
+		if (r % 3)
+			update(&h, DS, sl);
+		if (r % 7)
+			update(&h, P, kl);
+		if (r & 1)
+			update(&h, A, size);
+		else
+			update(&h, P, kl);
+		final(&h, A);
+	}
+
+	/* the setting as given, it is canonical */
+	memcpy(output, salt, s + sl - salt);
+	out = output + (s + sl - salt);
+	*out++ = '$';
+	if (h.sha512) {
+		for (i = 0; i < sizeof(order512) / sizeof(*order512); i++)
+			out = to64(out, A[order512[i][0]] << 16 | A[order512[i][1]] << 8 | A[order512[i][2]], 4);
+		out = to64(out, A[63], 2);
+	} else {
+		for (i = 0; i < sizeof(order256) / sizeof(*order256); i++)
+			out = to64(out, A[order256[i][0]] << 16 | A[order256[i][1]] << 8 | A[order256[i][2]], 4);
+		out = to64(out, A[31] << 8 | A[30], 3);
+	}
+	*out = '\0';
+
+	explicit_bzero(A, sizeof(A));
+	explicit_bzero(B, sizeof(B));
+	explicit_bzero(DP, sizeof(DP));
+	explicit_bzero(DS, sizeof(DS));
+	explicit_bzero(P, kl);
+	free(P);
+	return output;
+}
@@ -0,0 +1,15 @@
+#ifndef SHA_CRYPT_H
+#define SHA_CRYPT_H
+
+/* "$6$rounds=999999999$" 16 characters of salt '$' 86 characters of hash */
+#define SHA_CRYPT_OUTPUT_SIZE 128
+
+/*
+ * crypt() for $5$ and $6$ settings, with the SHA extensions or AVX2
+ * where the CPU has them. NULL for other schemes and for settings that
+ * aren't in the form crypt_gensalt makes, like too long salts or
+ * rounds out of range, which libcrypt implementations treat differently.
+ */
+char *sha_crypt_r(const char *key, const char *salt, char *output);
+
+#endif				/* SHA_CRYPT_H */
@@ -0,0 +1,140 @@
+/*
+ * Shared memory files, see shm.h.
+ * A file is mapped once per process and path and stays mapped.
+ * Counters that others could write can't be trusted: a writable file
+ * must be a regular file of this user or root that others can't write,
+ * one that is created is only for this user.
+ *
+ * This file may be distributed under the same terms as pam_pwdfile.c.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shm.h"
+
+struct shm_mapping {
+	struct shm_mapping *next;
+	char *path;
+	void *addr;
+	size_t size;
+};
+
+static struct shm_mapping *mappings;
+static pthread_mutex_t mappings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int valid(const struct shm_header *header, uint32_t magic, uint32_t version) {
+	return __atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) == magic
+		&& header->version == version;
+}
+
+static void *map(const char *path, size_t size, uint32_t magic, uint32_t version) {
+	struct shm_header *header;
+	struct stat st;
+	uint32_t zero = 0;
+	int fd;
+
+	if ((fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600)) == -1)
+		return NULL;
+	if (fstat(fd, &st) == -1)
+		goto failed;
+	if (!S_ISREG(st.st_mode) || (st.st_uid != geteuid() && st.st_uid != 0) || st.st_mode & S_IWOTH) {
+		errno = EPERM;
+		goto failed;
+	}
+	/* several processes may race to create it, all of them grow it to the same size */
+	if (st.st_size == 0 && ftruncate(fd, size) == -1)
+		goto failed;
+	else if (st.st_size != 0 && (size_t) st.st_size != size) {
+		errno = EINVAL;
+		goto failed;
+	}
+	header = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (header == MAP_FAILED)
+		return NULL;
+
+	if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) == 0) {
+		header->version = version;
+		__atomic_compare_exchange_n(&header->magic, &zero, magic, 0,
+					    __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+	}
+	if (!valid(header, magic, version)) {
+		munmap(header, size);
+		errno = EINVAL;
+		return NULL;
+	}
+	return header;
+
+failed:
+	close(fd);
+	return NULL;
+}
+
+/* map path for writing, creating it if needed */
+void *shm_get(const char *path, size_t size, uint32_t magic, uint32_t version) {
+	struct shm_mapping *m;
+	void *addr = NULL;
+
+	pthread_mutex_lock(&mappings_lock);
+	for (m = mappings; m; m = m->next)
+		if (!strcmp(m->path, path)) {
+			if (m->size == size && valid(m->addr, magic, version))
+				addr = m->addr;
+			else
+				errno = EINVAL;
+			goto out;
+		}
+	if (!(m = calloc(1, sizeof(*m))) || !(m->path = strdup(path))) {
+		free(m);
+		goto out;
+	}
+	if (!(m->addr = map(path, size, magic, version))) {
+		free(m->path);
+		free(m);
+		goto out;
+	}
+	m->size = size;
+	m->next = mappings;
+	mappings = m;
+	addr = m->addr;
+out:
+	pthread_mutex_unlock(&mappings_lock);
+	return addr;
+}
+
+/* map an existing file read-only, for readers */
+const void *shm_map(const char *path, size_t size, uint32_t magic, uint32_t version) {
+	struct shm_header *header;
+	struct stat st;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC)) == -1)
+		return NULL;
+	if (fstat(fd, &st) == -1)
+		goto failed;
+	if (!S_ISREG(st.st_mode) || (size_t) st.st_size != size) {
+		errno = EINVAL;
+		goto failed;
+	}
+	header = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (header == MAP_FAILED)
+		return NULL;
+	if (!valid(header, magic, version)) {
+		munmap(header, size);
+		errno = EINVAL;
+		return NULL;
+	}
+	return header;
+
+failed:
+	close(fd);
+	return NULL;
+}
@@ -0,0 +1,20 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Files shared by all processes using the module, on a tmpfs like /run.
+ * Each starts with a magic and a version number that readers check.
+ */
+
+struct shm_header {
+	uint32_t magic;
+	uint32_t version;
+};
+
+void *shm_get(const char *path, size_t size, uint32_t magic, uint32_t version);
+const void *shm_map(const char *path, size_t size, uint32_t magic, uint32_t version);
+
+#endif				/* SHM_H */
@@ -0,0 +1,50 @@
+/*
+ * Statistics in a shared memory segment, see stats.h.
+ *
+ * This file may be distributed under the same terms as pam_pwdfile.c.
+ */
+
+#include <stddef.h>
+#include <time.h>
+
+#include "scheme.h"
+#include "shm.h"
+#include "stats.h"
+
+_Static_assert(SCHEME_COUNT <= STATS_SCHEMES, "scheme counters don't fit");
+_Static_assert(STATS_OUTCOMES <= 8, "outcome counters don't fit");
+_Static_assert(offsetof(struct stats, version) == offsetof(struct shm_header, version), "no shm header");
+
+const char *const stats_outcome_names[STATS_OUTCOMES] = {
+	[STATS_SUCCESS] = "success",
+	[STATS_WRONG] = "wrong",
+	[STATS_UNKNOWN] = "unknown",
+	[STATS_UNAVAIL] = "unavail",
+	[STATS_OTHER] = "other",
+};
+
+/* map path for writing, creating it if needed */
+struct stats *stats_get(const char *path) {
+	return shm_get(path, sizeof(struct stats), STATS_MAGIC, STATS_VERSION);
+}
+
+/* map an existing segment read-only, for readers */
+const struct stats *stats_map(const char *path) {
+	return shm_map(path, sizeof(struct stats), STATS_MAGIC, STATS_VERSION);
+}
+
+uint64_t stats_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void stats_time(uint64_t *histogram, uint64_t ns) {
+	uint64_t us = ns / 1000;
+	unsigned bucket = us ? 64 - __builtin_clzll(us) : 0;
+
+	if (bucket >= STATS_BUCKETS)
+		bucket = STATS_BUCKETS - 1;
+	stats_add(&histogram[bucket], 1);
+}
@@ -0,0 +1,50 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+/*
+ * Counters shared by all processes using the same stats= file, on a tmpfs
+ * like /run. The layout is fixed, readers check magic and version.
+ * Histogram bucket 0 counts durations below 1us, bucket i durations
+ * of 2^(i-1) to 2^i - 1 us.
+ */
+
+#define STATS_MAGIC	0x70776473U	/* "pwds" */
+#define STATS_VERSION	1
+#define STATS_BUCKETS	32
+#define STATS_SCHEMES	16
+
+enum stats_outcome {
+	STATS_SUCCESS,
+	STATS_WRONG,		/* wrong password */
+	STATS_UNKNOWN,		/* user not in pwdfile */
+	STATS_UNAVAIL,		/* pwdfile missing or unreadable */
+	STATS_OTHER,
+	STATS_OUTCOMES
+};
+
+struct stats {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t outcomes[8];
+	uint64_t schemes[STATS_SCHEMES];	/* indexed by enum scheme */
+	uint64_t lookup_us[STATS_BUCKETS];
+	uint64_t crypt_us[STATS_BUCKETS];
+	uint64_t lock_waits;
+	uint64_t lock_wait_ns;
+	uint64_t reloads;	/* cache rebuilds after pwdfile changed */
+};
+
+extern const char *const stats_outcome_names[STATS_OUTCOMES];
+
+struct stats *stats_get(const char *path);
+const struct stats *stats_map(const char *path);
+uint64_t stats_now(void);
+void stats_time(uint64_t *histogram, uint64_t ns);
+
+static inline void stats_add(uint64_t *counter, uint64_t n) {
+	__atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+#endif				/* STATS_H */